@@ -4,6 +4,10 @@
 #include <algorithm>
 #include <iostream>
 
+// Tuned at 1 MS/s, keeping one sample in HW_RATIO.  Other rates keep whichever ratio gets closest to
+// the same output rate, and the filter and threshold decay are scaled to keep their time constants.
+// Both work out to exactly the tuned values at 1 MS/s, and the filter runs in double as it always has.
+#define HW_REFERENCE_RATE 1000000
 #define HW_RATIO 17
 
 #define MIN_OOK_THRESHOLD 0.25f
@@ -12,19 +16,28 @@
 
 #define FILTER_ALPHA 0.7
 
+AnalogDecoder::AnalogDecoder(uint32_t sampleRate) :
+    m_decimation(std::max(1L, std::lround((double)sampleRate*HW_RATIO/HW_REFERENCE_RATE))),
+    m_outputRate((float)sampleRate/m_decimation),
+    m_filterAlpha(std::pow(FILTER_ALPHA, (double)HW_REFERENCE_RATE/sampleRate)),
+    m_ookDecay(OOK_DECAY_PER_SAMPLE*(float)((double)m_decimation*HW_REFERENCE_RATE/HW_RATIO/sampleRate))
+{
+    std::cout << "Keeping 1 in " << m_decimation << " samples, " << m_outputRate << " S/s" << std::endl;
+}
+
 
 void AnalogDecoder::handleMagnitude(float val)
 {
     //
     // Smooth
     //
-    m_val = (FILTER_ALPHA)*m_val + (1.0 - FILTER_ALPHA)*val;
+    m_val = m_filterAlpha*m_val + (1.0 - m_filterAlpha)*val;
     val = m_val;
     
     //
     // 1 of N
     //
-    if(m_discardedSamples < (HW_RATIO-1))
+    if(m_discardedSamples < (m_decimation - 1))
     {
         m_discardedSamples++;
         return;
@@ -35,12 +48,17 @@ void AnalogDecoder::handleMagnitude(float val)
     //
     // Saturate
     //
+    m_levels.samples++;
+    if(val > 1.0f)
+    {
+        m_levels.clippedSamples++;
+    }
     val = std::min(val, 1.0f);
 
     //
     // Threshold
     //
-    m_ookMax -= OOK_DECAY_PER_SAMPLE;
+    m_ookMax -= m_ookDecay;
     m_ookMax = std::max(m_ookMax, val);
     m_ookMax = std::max(m_ookMax, MIN_OOK_THRESHOLD/OOK_THRESHOLD_RATIO);
 
@@ -50,15 +68,28 @@ void AnalogDecoder::handleMagnitude(float val)
     int digital;
     if(m_cb)
     {
-        if(val > m_ookMax*OOK_THRESHOLD_RATIO)
+        const float threshold = m_ookMax*OOK_THRESHOLD_RATIO;
+
+        // Confidence is the distance from the threshold as a fraction of the room on that side of it
+        if(val > threshold)
         {
             digital = 1;
-            m_cb(1);
+            m_highSamples++;
+            m_cb(1, (val - threshold)/(m_ookMax - threshold), val);
         }
         else
         {
             digital = 0;
-            m_cb(0);
+            m_levels.noiseSum += val;
+            m_levels.noiseSamples++;
+            m_cb(0, (threshold - val)/threshold, val);
         }
     }
 }
+
+AnalogDecoder::Levels AnalogDecoder::takeLevels()
+{
+    const Levels levels = m_levels;
+    m_levels = {0.0f, 0, 0, 0};
+    return levels;
+}
@@ -2,19 +2,48 @@
 #define __ANALOG_DECODER_H__
 
 #include <functional>
+#include <stdint.h>
 
 class AnalogDecoder
 {
   public:
-    AnalogDecoder() = default;
+    AnalogDecoder(uint32_t sampleRate);
     
     void handleMagnitude(float value);
-    void setCallback(std::function<void(char)> cb) {m_cb = cb;};
+
+    // Rate of the decimated samples handed to the callback; close to the same for any input rate
+    float outputRate() const {return m_outputRate;};
+    int decimation() const {return m_decimation;};
+
+    // Called with each decimated sample, its confidence, 0 (on the threshold) to 1, and its level
+    // relative to full scale
+    void setCallback(std::function<void(char, float, float)> cb) {m_cb = cb;};
+
+    // Number of decimated samples so far that were above the OOK threshold
+    uint32_t highSampleCount() const {return m_highSamples;};
+
+    // Decimated samples since the last call: the sum and number of those below the OOK threshold, and
+    // how many of all of them were beyond full scale
+    struct Levels
+    {
+        float noiseSum;
+        uint32_t noiseSamples;
+        uint32_t clippedSamples;
+        uint32_t samples;
+    };
+    Levels takeLevels();
     
   private:
-    std::function<void(char)> m_cb;
+    std::function<void(char, float, float)> m_cb;
+    
+    const int m_decimation;
+    const float m_outputRate;
+    const double m_filterAlpha;
+    const float m_ookDecay;
     
     int m_discardedSamples = 0;
+    uint32_t m_highSamples = 0;
+    Levels m_levels = {0.0f, 0, 0, 0};
     float m_ookMax = 0.0;
     float m_val = 0.0;
 };
@@ -0,0 +1,91 @@
+#include "archiveSource.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+
+// Same size as the transfers librtlsdr delivers by default
+#define REPLAY_BUFFER_LEN (16*32*512)
+
+// Silence after each burst, long enough for the decoder to finish the last frame and for the OOK
+// threshold to decay from full scale, so that a loud burst doesn't hide a weak one after it
+#define ARCHIVE_GAP_MS (150)
+
+bool ArchiveSource::open()
+{
+    if(!m_reader.open(m_dir.c_str()))
+    {
+        return false;
+    }
+
+    if(m_serial)
+    {
+        // The time range is applied as the bursts are read
+        m_bursts = m_reader.findBySerial(m_serial);
+    }
+    else
+    {
+        m_bursts = m_reader.findByTime(m_fromUs, m_toUs);
+    }
+
+    std::cout << "Found " << m_bursts.size() << " bursts in " << m_dir << std::endl;
+    return true;
+}
+
+int ArchiveSource::run(Callback cb, void *ctx)
+{
+    BurstRecordHeader header;
+    std::vector<BurstFrame> frames;
+    std::vector<unsigned char> iq;
+    std::vector<unsigned char> buffer(REPLAY_BUFFER_LEN);
+    int err = 0;
+
+    for(const BurstArchiveReader::Location &location : m_bursts)
+    {
+        if(m_stop)
+        {
+            break;
+        }
+        // By the same time the range was searched by, so that -T picks the same bursts with and
+        // without -S
+        if(location.timeUs < m_fromUs || location.timeUs >= m_toUs)
+        {
+            continue;
+        }
+        if(!m_reader.read(location, header, frames, iq))
+        {
+            err = -1;
+            continue;
+        }
+        if(header.sampleRate != m_sampleRate)
+        {
+            std::cout << "Skipping a burst recorded at " << header.sampleRate << " samples/s" << std::endl;
+            continue;
+        }
+
+        const time_t seconds = header.timeUs/1000000;
+        char stamp[32];
+        strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&seconds));
+        printf("Burst at %s.%03u, sample %llu, %u samples, frames:", stamp, (unsigned)(header.timeUs%1000000)/1000,
+            (unsigned long long)header.sampleOffset, header.sampleCount);
+        for(const BurstFrame &frame : frames)
+        {
+            printf(" %u%s", frame.serial, frame.crcOk ? "" : "(invalid)");
+        }
+        printf("\n");
+
+        // Then enough silence for the decoder to give up on the last frame
+        iq.resize(iq.size() + (size_t)m_sampleRate*ARCHIVE_GAP_MS/1000*2, 127);
+
+        for(size_t offset = 0; offset < iq.size() && !m_stop; offset += buffer.size())
+        {
+            const size_t len = std::min(buffer.size(), iq.size() - offset);
+            std::copy(iq.begin() + offset, iq.begin() + offset + len, buffer.begin());
+            countBytes(len);
+            cb(buffer.data(), len, ctx);
+        }
+    }
+
+    return err;
+}
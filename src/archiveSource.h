@@ -0,0 +1,44 @@
+#ifndef __ARCHIVE_SOURCE_H__
+#define __ARCHIVE_SOURCE_H__
+
+#include "inputSource.h"
+#include "burstArchive.h"
+
+#include <string>
+#include <vector>
+
+//
+// The bursts in a burst archive, one after another with a little silence between them, read as fast
+// as the decoder can take them.  Either every burst in a time range, or only those holding a frame
+// from one serial.
+//
+class ArchiveSource : public InputSource
+{
+  public:
+    // A serial of 0 takes bursts from any sensor
+    ArchiveSource(const char *dir, uint64_t fromUs, uint64_t toUs, uint32_t serial) :
+        m_dir(dir), m_fromUs(fromUs), m_toUs(toUs), m_serial(serial) {};
+
+    bool open() override;
+    bool setFrequency(uint32_t) override {return true;};
+    bool setSampleRate(uint32_t rate) override {m_sampleRate = rate; return true;};
+    bool setGain(int, int) override {return true;};
+    bool setFreqCorrection(int) override {return true;};
+    bool isTunable() const override {return false;};
+
+    int run(Callback cb, void *ctx) override;
+    void stop() override {m_stop = true;};
+
+  private:
+    const std::string m_dir;
+    const uint64_t m_fromUs;
+    const uint64_t m_toUs;
+    const uint32_t m_serial;
+    uint32_t m_sampleRate = 0;
+
+    BurstArchiveReader m_reader;
+    std::vector<BurstArchiveReader::Location> m_bursts;
+    std::atomic<bool> m_stop{false};
+};
+
+#endif
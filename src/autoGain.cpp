@@ -0,0 +1,334 @@
+#include "autoGain.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <sys/time.h>
+
+// Measurements are thrown away for this long after a gain change while the tuner settles
+#define CAL_SETTLE_MS (100)
+
+// Time spent measuring the noise floor at each gain at startup
+#define CAL_DWELL_MS (400)
+
+// How often the gain is reconsidered while running
+#ifndef CAL_ADJUST_SEC
+#define CAL_ADJUST_SEC (5*60)
+#endif
+
+// Frames needed at a gain before its margin counts for anything
+#define CAL_MIN_FRAMES (8)
+#define CAL_MAX_FRAMES (1024)
+
+// The slicer never goes below MIN_OOK_THRESHOLD (0.25) in the analog decoder, so the noise has to stay
+// well under that, and a frame needs to be above it by as much as it is above the noise
+#define CAL_SLICER_FLOOR_DBFS (-12.0f)
+#define CAL_MAX_NOISE_DBFS (-24.0f)
+
+// A frame that reaches full scale has been clipped; a few noise samples that do are tolerated
+#define CAL_SATURATION_DBFS (-0.5f)
+#define CAL_MAX_CLIPPED (0.0001f)
+
+// A step up is only kept if the margin improved by this much, and a gain that had to be left isn't
+// tried again for a day
+#define CAL_MIN_IMPROVEMENT_DB (1.0f)
+#define CAL_CEILING_SEC (24*60*60)
+
+static uint64_t nowUs()
+{
+    timeval now;
+    gettimeofday(&now, nullptr);
+    return (uint64_t)now.tv_sec*1000000 + now.tv_usec;
+}
+
+float AutoGain::Window::noiseDbfs() const
+{
+    return 20.0f*std::log10(std::max(noiseSamples ? (float)(noiseSum/noiseSamples) : 0.0f, 1e-6f));
+}
+
+float AutoGain::Window::clippedFraction() const
+{
+    return samples ? (float)clippedSamples/samples : 0.0f;
+}
+
+/* Margin of the weaker frames: the lower quartile, so that a couple of chatty nearby sensors don't
+   hide a distant one */
+float AutoGain::Window::marginDb() const
+{
+    if(margins.size() < CAL_MIN_FRAMES)
+    {
+        return NAN;
+    }
+
+    std::vector<float> sorted(margins);
+    std::nth_element(sorted.begin(), sorted.begin() + sorted.size()/4, sorted.end());
+    return sorted[sorted.size()/4];
+}
+
+AutoGain::AutoGain(InputSource &source) : m_source(source)
+{
+    m_thread = std::thread(&AutoGain::run, this);
+}
+
+AutoGain::~AutoGain()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cond.notify_one();
+    m_thread.join();
+}
+
+void AutoGain::setEnabled(bool enabled)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(enabled && !m_enabled)
+        {
+            m_restart = true;
+        }
+        m_enabled = enabled;
+    }
+    m_cond.notify_one();
+}
+
+void AutoGain::handleLevels(float noiseSum, uint32_t noiseSamples, uint32_t clippedSamples, uint32_t samples)
+{
+    std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+    if(!lock.owns_lock() || !m_enabled || nowUs() < m_settleUntilUs)
+    {
+        return;
+    }
+
+    m_window.noiseSum += noiseSum;
+    m_window.noiseSamples += noiseSamples;
+    m_window.clippedSamples += clippedSamples;
+    m_window.samples += samples;
+}
+
+void AutoGain::handleFrame(float meanDbfs, float peakDbfs, float noiseDbfs)
+{
+    std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+    if(!lock.owns_lock() || !m_enabled || nowUs() < m_settleUntilUs)
+    {
+        return;
+    }
+
+    if(peakDbfs >= CAL_SATURATION_DBFS)
+    {
+        m_window.saturatedFrames++;
+    }
+
+    if(m_window.margins.size() < CAL_MAX_FRAMES)
+    {
+        m_window.margins.push_back(std::min(meanDbfs - noiseDbfs, meanDbfs - CAL_SLICER_FLOOR_DBFS));
+    }
+}
+
+void AutoGain::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while(true)
+    {
+        m_cond.wait(lock, [this]{return m_stop || (m_enabled && m_restart);});
+        if(m_stop)
+        {
+            break;
+        }
+        m_restart = false;
+        lock.unlock();
+
+        // rtl_tcp only learns which tuner it has once it is connected
+        m_gains = m_source.tunerGains();
+        while(m_gains.empty() && waitFor(1000))
+        {
+            m_gains = m_source.tunerGains();
+        }
+
+        if(!m_gains.empty())
+        {
+            calibrate();
+            while(waitFor(CAL_ADJUST_SEC*1000))
+            {
+                adjust();
+            }
+        }
+
+        lock.lock();
+    }
+}
+
+/* Sleeps, unless told to stop, to start over, or to leave the gain alone.  Returns false if so. */
+bool AutoGain::waitFor(int ms)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cond.wait_for(lock, std::chrono::milliseconds(ms), [this]{return m_stop || m_restart || !m_enabled;});
+    return !m_stop && !m_restart && m_enabled;
+}
+
+void AutoGain::applyGain(size_t index)
+{
+    // Under the lock, so that a gain set by hand right after disabling can't be overridden
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(!m_enabled)
+    {
+        return;
+    }
+
+    m_index = index;
+    m_source.setGain(0, m_gains[index]);
+    m_settleUntilUs = nowUs() + CAL_SETTLE_MS*1000;
+    m_window = Window();
+    m_window.margins.reserve(CAL_MAX_FRAMES);
+}
+
+AutoGain::Window AutoGain::takeWindow()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Window window;
+    std::swap(window, m_window);
+
+    // Allocated here so that the decoder never has to
+    m_window.margins.reserve(CAL_MAX_FRAMES);
+    return window;
+}
+
+void AutoGain::calibrate()
+{
+    std::cout << "Calibrating gain over " << m_gains.size() << " steps" << std::endl;
+
+    m_noiseDbfs.assign(m_gains.size(), 0.0f);
+    size_t best = 0;
+    for(size_t ii = 0; ii < m_gains.size(); ++ii)
+    {
+        applyGain(ii);
+        if(!waitFor(CAL_SETTLE_MS + CAL_DWELL_MS))
+        {
+            return;
+        }
+
+        // Clipping noise is as bad as noise near the threshold
+        const Window window = takeWindow();
+        m_noiseDbfs[ii] = (window.clippedFraction() > CAL_MAX_CLIPPED) ? 0.0f : window.noiseDbfs();
+        printf("Gain %.1fdB: noise floor %.1fdBFS, %.4f%% clipped\n", m_gains[ii]/10.0f, window.noiseDbfs(), 100.0f*window.clippedFraction());
+
+        if(m_noiseDbfs[ii] <= CAL_MAX_NOISE_DBFS)
+        {
+            best = ii;
+        }
+    }
+
+    m_ceiling = m_gains.size() - 1;
+    m_ceilingUntil = 0;
+    m_probing = false;
+    m_pending = Window();
+    applyGain(best);
+
+    Window calibrated;
+    calibrated.noiseSum = std::pow(10.0f, m_noiseDbfs[best]/20.0f);
+    calibrated.noiseSamples = 1;
+    report(calibrated, "calibrated");
+}
+
+void AutoGain::adjust()
+{
+    //
+    // Keep collecting until there are enough frames to judge the gain by
+    //
+    Window window = takeWindow();
+    m_pending.noiseSum += window.noiseSum;
+    m_pending.noiseSamples += window.noiseSamples;
+    m_pending.clippedSamples += window.clippedSamples;
+    m_pending.samples += window.samples;
+    m_pending.saturatedFrames += window.saturatedFrames;
+    m_pending.margins.insert(m_pending.margins.end(), window.margins.begin(), window.margins.end());
+
+    const time_t now = time(nullptr);
+    if(m_ceilingUntil && now >= m_ceilingUntil)
+    {
+        m_ceiling = m_gains.size() - 1;
+        m_ceilingUntil = 0;
+    }
+
+    const float noise = m_pending.noiseDbfs();
+    const float margin = m_pending.marginDb();
+    if(m_pending.noiseSamples)
+    {
+        m_noiseDbfs[m_index] = noise;
+    }
+
+    const char *decision;
+    size_t next = m_index;
+    if(m_pending.saturatedFrames || m_pending.clippedFraction() > CAL_MAX_CLIPPED || noise > CAL_MAX_NOISE_DBFS)
+    {
+        // Back off straight away, and don't come back for a while
+        decision = m_pending.saturatedFrames ? "saturated" : "noisy";
+        if(m_index > 0)
+        {
+            next = m_index - 1;
+            m_ceiling = next;
+            m_ceilingUntil = now + CAL_CEILING_SEC;
+        }
+        m_probing = false;
+    }
+    else if(std::isnan(margin))
+    {
+        report(m_pending, "waiting");
+        return;
+    }
+    else if(m_probing)
+    {
+        m_probing = false;
+        if(margin < m_marginBeforeProbe + CAL_MIN_IMPROVEMENT_DB)
+        {
+            decision = "reverted";
+            next = m_index - 1;
+            m_ceiling = next;
+            m_ceilingUntil = now + CAL_CEILING_SEC;
+        }
+        else
+        {
+            decision = "kept";
+        }
+    }
+    else if(m_index < m_ceiling && m_noiseDbfs[m_index + 1] <= CAL_MAX_NOISE_DBFS)
+    {
+        decision = "probing";
+        m_probing = true;
+        m_marginBeforeProbe = margin;
+        next = m_index + 1;
+    }
+    else
+    {
+        decision = "holding";
+    }
+
+    report(m_pending, decision);
+    m_pending = Window();
+    if(next != m_index)
+    {
+        applyGain(next);
+    }
+}
+
+void AutoGain::report(const Window &window, const char *decision)
+{
+    Report report;
+    report.gain = m_gains[m_index];
+    report.noiseDbfs = window.noiseDbfs();
+    report.marginDb = window.marginDb();
+    report.decision = decision;
+
+    printf("Gain %.1fdB: noise floor %.1fdBFS, margin %.1fdB over %zu frames, %s\n", report.gain/10.0f, report.noiseDbfs,
+        report.marginDb, window.margins.size(), decision);
+
+    if(m_reportCb)
+    {
+        m_reportCb(report);
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef __AUTO_GAIN_H__
+#define __AUTO_GAIN_H__
+
+#include "inputSource.h"
+
+#include <stdint.h>
+#include <condition_variable>
+#include <ctime>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//
+// Picks the tuner gain on its own.  At startup it steps through every gain the tuner offers and
+// measures the noise floor at each, then starts from the highest gain that keeps the noise well
+// below the slicer's minimum threshold.  After that it looks at the frames received every few minutes:
+// it backs off a step when frames or noise saturate, and otherwise tries one step up, keeping it only
+// if the weaker frames' decode margin got better.
+//
+// The receive callback and the decoder hand over their measurements without ever waiting; the
+// decisions and gain changes happen on a background thread.
+//
+class AutoGain
+{
+  public:
+    struct Report
+    {
+        int gain;                   // Tenths of a dB, as librtlsdr has it
+        float noiseDbfs;
+        float marginDb;             // NAN until enough frames have been seen at this gain
+        std::string decision;
+    };
+
+    AutoGain(InputSource &source);
+    ~AutoGain();
+
+    // Calibrates when enabled, and leaves the gain alone while disabled
+    void setEnabled(bool enabled);
+
+    // From the receive callback, with what the analog decoder saw since the last call
+    void handleLevels(float noiseSum, uint32_t noiseSamples, uint32_t clippedSamples, uint32_t samples);
+
+    // From the decoder, for every valid frame
+    void handleFrame(float meanDbfs, float peakDbfs, float noiseDbfs);
+
+    // Called from the background thread after every decision
+    void setReportCallback(std::function<void(const Report &)> cb) {m_reportCb = cb;};
+
+  private:
+    // What was measured since the last takeWindow()
+    struct Window
+    {
+        double noiseSum = 0.0;
+        uint64_t noiseSamples = 0;
+        uint64_t clippedSamples = 0;
+        uint64_t samples = 0;
+        uint32_t saturatedFrames = 0;
+        std::vector<float> margins;
+
+        float noiseDbfs() const;
+        float clippedFraction() const;
+        float marginDb() const;
+    };
+
+    void run();
+    bool waitFor(int ms);
+    void applyGain(size_t index);
+    Window takeWindow();
+    void calibrate();
+    void adjust();
+    void report(const Window &window, const char *decision);
+
+    InputSource &m_source;
+    std::function<void(const Report &)> m_reportCb;
+
+    // Only touched by the background thread
+    std::vector<int> m_gains;
+    std::vector<float> m_noiseDbfs;
+    size_t m_index = 0;
+    size_t m_ceiling = 0;
+    time_t m_ceilingUntil = 0;
+    bool m_probing = false;
+    float m_marginBeforeProbe = 0.0f;
+    Window m_pending;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_enabled = false;
+    bool m_restart = false;
+    bool m_stop = false;
+    uint64_t m_settleUntilUs = 0;
+    Window m_window;
+    std::thread m_thread;
+};
+
+#endif
@@ -0,0 +1,228 @@
+#include "batchedSink.h"
+
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// A partly filled batch goes out once its oldest event is this old
+#define BATCH_FLUSH_MS (200)
+
+// Batches waiting for the writer before new events get dropped
+#define BATCH_QUEUE_MAX (64)
+
+// Don't complain about dropped events more than once per minute
+#define DROP_REPORT_MIN_SEC (60)
+
+#define JSON_SINK_BATCH_LEN (64*1024)
+
+// Largest UDP payload that fits in one Ethernet frame
+#define UDP_SINK_DATAGRAM_LEN (1472)
+
+void BatchedSink::start()
+{
+    m_thread = std::thread(&BatchedSink::run, this);
+}
+
+void BatchedSink::finish()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cond.notify_one();
+
+    if(m_thread.joinable())
+    {
+        m_thread.join();
+    }
+}
+
+void BatchedSink::send(const Event &event)
+{
+    std::string line = event.toJson();
+    line += '\n';
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(!m_pending.empty() && m_pending.size() + line.size() > m_maxBatch)
+    {
+        if(m_batches.size() >= BATCH_QUEUE_MAX)
+        {
+            // Count them so the writer can say how many were lost
+            m_dropped++;
+            return;
+        }
+
+        m_batches.push_back(std::move(m_pending));
+        m_pending.clear();
+        m_cond.notify_one();
+    }
+
+    if(m_pending.empty())
+    {
+        m_pendingSinceUs = event.timestampUs;
+    }
+    m_pending += line;
+}
+
+void BatchedSink::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while(true)
+    {
+        m_cond.wait_for(lock, std::chrono::milliseconds(BATCH_FLUSH_MS), [this]{return m_stop || !m_batches.empty();});
+
+        //
+        // Send the partial batch as well if it has waited long enough
+        //
+        timeval now;
+        gettimeofday(&now, nullptr);
+        const uint64_t nowUs = (uint64_t)now.tv_sec*1000000 + now.tv_usec;
+
+        if(!m_pending.empty() && (m_stop || nowUs - m_pendingSinceUs >= BATCH_FLUSH_MS*1000))
+        {
+            m_batches.push_back(std::move(m_pending));
+            m_pending.clear();
+        }
+
+        uint64_t dropped = 0;
+        if(m_dropped && (m_stop || now.tv_sec - m_lastDropReportTime >= DROP_REPORT_MIN_SEC))
+        {
+            dropped = m_dropped;
+            m_dropped = 0;
+            m_lastDropReportTime = now.tv_sec;
+        }
+
+        std::deque<std::string> batches;
+        batches.swap(m_batches);
+        const bool stop = m_stop;
+        lock.unlock();
+
+        if(dropped)
+        {
+            std::cout << "Output can't keep up, dropped " << dropped << " events" << std::endl;
+        }
+
+        for(const std::string &batch : batches)
+        {
+            write(batch);
+        }
+
+        if(stop)
+        {
+            break;
+        }
+        lock.lock();
+    }
+}
+
+JsonSink::JsonSink() : BatchedSink(JSON_SINK_BATCH_LEN)
+{
+}
+
+JsonSink::~JsonSink()
+{
+    finish();
+
+    if(m_file)
+    {
+        fclose(m_file);
+    }
+}
+
+bool JsonSink::open(const char *path)
+{
+    if(strcmp(path, "-") == 0)
+    {
+        //
+        // Events get stdout to themselves: the sink writes to a copy of it, and stdout itself, which
+        // every log message goes to, becomes stderr
+        //
+        static bool stdoutTaken = false;
+        if(stdoutTaken)
+        {
+            std::cerr << "Only one output can go to stdout" << std::endl;
+            return false;
+        }
+
+        fflush(stdout);
+        const int fd = dup(STDOUT_FILENO);
+        m_file = (fd >= 0) ? fdopen(fd, "w") : nullptr;
+        if(!m_file || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+        {
+            std::cerr << "Failed to take over stdout: " << strerror(errno) << std::endl;
+            return false;
+        }
+        stdoutTaken = true;
+    }
+    else
+    {
+        m_file = fopen(path, "a");
+        if(!m_file)
+        {
+            std::cout << "Failed to open " << path << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+    }
+
+    start();
+    return true;
+}
+
+void JsonSink::write(const std::string &batch)
+{
+    fwrite(batch.data(), 1, batch.size(), m_file);
+    fflush(m_file);
+}
+
+UdpSink::UdpSink() : BatchedSink(UDP_SINK_DATAGRAM_LEN)
+{
+}
+
+UdpSink::~UdpSink()
+{
+    finish();
+
+    if(m_fd >= 0)
+    {
+        close(m_fd);
+    }
+}
+
+bool UdpSink::open(int port)
+{
+    m_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if(m_fd < 0)
+    {
+        std::cout << "Failed to create UDP socket: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if(connect(m_fd, (sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        std::cout << "Failed to set UDP destination port " << port << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    start();
+    return true;
+}
+
+void UdpSink::write(const std::string &batch)
+{
+    // Nobody listening (ECONNREFUSED) is fine; the events are simply gone
+    ::send(m_fd, batch.data(), batch.size(), 0);
+}
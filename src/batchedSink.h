@@ -0,0 +1,87 @@
+#ifndef __BATCHED_SINK_H__
+#define __BATCHED_SINK_H__
+
+#include "eventSink.h"
+
+#include <cstdio>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+//
+// Collects events as newline-delimited JSON and writes them out in batches from a thread of its own,
+// so the decoder never waits on a disk or a socket.  A batch goes out once it is full or once its
+// oldest event has waited long enough.  If the writer falls far behind, new events are dropped.
+//
+// Derived classes call start() once they are ready to write and finish() in their destructor, which
+// writes out whatever is still queued.
+//
+class BatchedSink : public EventSink
+{
+  public:
+    BatchedSink(size_t maxBatch) : m_maxBatch(maxBatch) {}
+
+    void send(const Event &event) override;
+
+  protected:
+    void start();
+    void finish();
+
+    // Called from the writer thread with whole lines, at most maxBatch bytes unless a single line
+    // is longer than that
+    virtual void write(const std::string &batch) = 0;
+
+  private:
+    void run();
+
+    const size_t m_maxBatch;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::string m_pending;
+    uint64_t m_pendingSinceUs = 0;
+    std::deque<std::string> m_batches;
+    uint64_t m_dropped = 0;
+    time_t m_lastDropReportTime = 0;
+    bool m_stop = false;
+    std::thread m_thread;
+};
+
+//
+// Appends to a file, or writes to stdout for "-"
+//
+class JsonSink : public BatchedSink
+{
+  public:
+    JsonSink();
+    ~JsonSink();
+
+    bool open(const char *path);
+
+  private:
+    void write(const std::string &batch) override;
+
+    FILE *m_file = nullptr;
+};
+
+//
+// Sends datagrams to a port on localhost, each holding as many whole events as fit in one Ethernet
+// frame
+//
+class UdpSink : public BatchedSink
+{
+  public:
+    UdpSink();
+    ~UdpSink();
+
+    bool open(int port);
+
+  private:
+    void write(const std::string &batch) override;
+
+    int m_fd = -1;
+};
+
+#endif
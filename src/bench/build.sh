@@ -0,0 +1,3 @@
+#!/bin/sh
+g++  -o deviceTableBench -fdiagnostics-color --std=c++11 -O2 deviceTableBench.cpp
+g++  -o snapshotBench -fdiagnostics-color --std=c++11 -O2 snapshotBench.cpp ../deviceSnapshot.cpp -pthread
@@ -0,0 +1,190 @@
+//
+// Compares the decoder's device tables with the std::map they replaced, e.g.
+//
+//   ./deviceTableBench 10000
+//
+// for 10k devices (the default).  Every frame probes the keypad table, which mostly misses, and then
+// updates one sensor; the supervision check walks every sensor.  Memory is what the heap grew by.
+//
+
+#include "../deviceTable.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include <malloc.h>
+
+#define FRAMES (20000000)
+#define SWEEPS (2000)
+
+// The state as it was kept in std::map, before DeviceTable
+struct mapSensorState_t
+{
+    uint64_t lastUpdateTime;
+    bool hasLostSupervision;
+    bool loop1, loop2, loop3, tamper, lowBat;
+};
+
+struct mapKeypadState_t
+{
+    uint64_t lastUpdateTime;
+    bool hasLostSupervision;
+    std::string phrase;
+    char sequence;
+    bool lowBat;
+};
+
+// The same packed layouts as DigitalDecoder's
+struct sensorState_t
+{
+    uint32_t lastUpdateTime;
+    bool hasLostSupervision : 1;
+    bool loop1 : 1;
+    bool loop2 : 1;
+    bool loop3 : 1;
+    bool tamper : 1;
+    bool lowBat : 1;
+};
+
+struct keypadState_t
+{
+    uint32_t lastUpdateTime;
+    bool hasLostSupervision : 1;
+    bool lowBat : 1;
+    char sequence;
+    uint8_t phraseLength;
+    char phrase[11];
+};
+
+static double now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static size_t heapUsed()
+{
+    return mallinfo2().uordblks;
+}
+
+int main(int argc, char **argv)
+{
+    const int devices = (argc > 1) ? atoi(argv[1]) : 10000;
+    const int keypads = std::max(devices/10, 1);
+
+    std::mt19937 rng(1);
+    std::vector<uint32_t> serials(devices);
+    std::vector<uint32_t> sensorLookups(FRAMES);
+    std::vector<uint32_t> keypadLookups(FRAMES);
+    for(uint32_t &serial : serials)
+    {
+        serial = rng() & 0xFFFFF;
+    }
+    for(int ii = 0; ii < FRAMES; ++ii)
+    {
+        sensorLookups[ii] = serials[rng() % devices];
+        keypadLookups[ii] = rng() & 0xFFFFF;
+    }
+
+    //
+    // Fill both kinds of table with the same devices
+    //
+    size_t heapStart = heapUsed();
+    std::map<uint32_t, mapSensorState_t> *sensorMap = new std::map<uint32_t, mapSensorState_t>;
+    for(uint32_t serial : serials)
+    {
+        (*sensorMap)[serial] = mapSensorState_t();
+    }
+    const size_t sensorMapBytes = heapUsed() - heapStart;
+
+    heapStart = heapUsed();
+    std::map<uint32_t, mapKeypadState_t> *keypadMap = new std::map<uint32_t, mapKeypadState_t>;
+    for(int ii = 0; ii < keypads; ++ii)
+    {
+        (*keypadMap)[serials[ii]] = mapKeypadState_t{0, false, "1234", 1, false};
+    }
+    const size_t keypadMapBytes = heapUsed() - heapStart;
+
+    DeviceTable<sensorState_t> sensorTable;
+    DeviceTable<keypadState_t> keypadTable;
+    bool inserted;
+    for(uint32_t serial : serials)
+    {
+        sensorTable.insert(serial, inserted);
+    }
+    for(int ii = 0; ii < keypads; ++ii)
+    {
+        keypadTable.insert(serials[ii], inserted);
+    }
+
+    //
+    // The update path for one frame: the map took a find and then operator[] for the write back
+    //
+    uint64_t checksum = 0;
+    const double mapStart = now();
+    for(int ii = 0; ii < FRAMES; ++ii)
+    {
+        if(keypadMap->find(keypadLookups[ii]) != keypadMap->end())
+        {
+            checksum++;
+        }
+        mapSensorState_t current = sensorMap->find(sensorLookups[ii])->second;
+        current.lastUpdateTime = ii;
+        (*sensorMap)[sensorLookups[ii]] = current;
+    }
+
+    const double tableStart = now();
+    for(int ii = 0; ii < FRAMES; ++ii)
+    {
+        if(keypadTable.find(keypadLookups[ii]))
+        {
+            checksum++;
+        }
+        sensorState_t &state = sensorTable.insert(sensorLookups[ii], inserted);
+        sensorState_t current = state;
+        current.lastUpdateTime = ii;
+        state = current;
+    }
+    const double updateEnd = now();
+
+    //
+    // The supervision check
+    //
+    const double mapSweepStart = now();
+    for(int sweep = 0; sweep < SWEEPS; ++sweep)
+    {
+        for(const auto &device : *sensorMap)
+        {
+            checksum += (device.second.lastUpdateTime > (uint64_t)sweep);
+        }
+    }
+
+    const double tableSweepStart = now();
+    for(int sweep = 0; sweep < SWEEPS; ++sweep)
+    {
+        sensorTable.forEach([&](uint32_t, sensorState_t &state)
+        {
+            checksum += (state.lastUpdateTime > (uint32_t)sweep);
+        });
+    }
+    const double sweepEnd = now();
+
+    printf("%d sensors, %d keypads\n", devices, keypads);
+    printf("Per frame:        map %.1f ns, table %.1f ns\n",
+        (tableStart - mapStart)/FRAMES*1e9, (updateEnd - tableStart)/FRAMES*1e9);
+    printf("Supervision:      map %.1f us, table %.1f us\n",
+        (tableSweepStart - mapSweepStart)/SWEEPS*1e6, (sweepEnd - tableSweepStart)/SWEEPS*1e6);
+    printf("Bytes per sensor: map %.1f, table %.1f\n", (double)sensorMapBytes/devices, (double)sensorTable.memoryUsage()/devices);
+    printf("Bytes per keypad: map %.1f, table %.1f\n", (double)keypadMapBytes/keypads, (double)keypadTable.memoryUsage()/keypads);
+
+    // Keeps the loops from being optimised away
+    printf("(%llu)\n", (unsigned long long)checksum);
+
+    delete sensorMap;
+    delete keypadMap;
+    return 0;
+}
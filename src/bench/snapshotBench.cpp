@@ -0,0 +1,86 @@
+//
+// What publishing a device snapshot costs the decoding thread, on its own and with a reader querying
+// back to back, for 100, 1k and 10k devices.  Publishing takes as long as the decoder's copy of its
+// tables; the reader turns every snapshot it gets into JSON, as the snapshot socket does.
+//
+
+#include "../deviceSnapshot.h"
+
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <thread>
+
+#define PUBLISH_COPIES (1000000)
+#define LOADED_SEC (1.0)
+
+static double now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* The decoder's copy of its tables, with a keypad for every tenth sensor */
+static const DeviceSnapshot *makeSnapshot(int devices, uint64_t generation)
+{
+    DeviceSnapshot *snapshot = new DeviceSnapshot();
+    snapshot->generation = generation;
+    snapshot->createdTime = time(nullptr);
+    snapshot->supervisionTimeoutSec = 3600;
+
+    snapshot->sensors.reserve(devices);
+    for(int ii = 0; ii < devices; ++ii)
+    {
+        snapshot->sensors.push_back({(uint32_t)ii*37 + 1, (uint32_t)snapshot->createdTime, false, true, false, false, false, false});
+    }
+    snapshot->keypads.reserve(devices/10);
+    for(int ii = 0; ii < devices/10; ++ii)
+    {
+        snapshot->keypads.push_back({(uint32_t)ii*41 + 1, (uint32_t)snapshot->createdTime, false, false});
+    }
+    return snapshot;
+}
+
+int main()
+{
+    for(int devices : {100, 1000, 10000})
+    {
+        SnapshotPublisher publisher;
+        uint64_t generation = 0;
+
+        const int publishes = PUBLISH_COPIES/devices;
+        double start = now();
+        for(int ii = 0; ii < publishes; ++ii)
+        {
+            publisher.publish(makeSnapshot(devices, ++generation));
+        }
+        const double publishUs = (now() - start)/publishes*1e6;
+
+        std::atomic<bool> stop(false);
+        std::atomic<uint64_t> reads(0);
+        size_t jsonLen = 0;
+        std::thread reader([&]()
+        {
+            while(!stop)
+            {
+                SnapshotPublisher::Reader snapshot(publisher);
+                jsonLen = snapshot.get()->toJson(time(nullptr)).size();
+                reads++;
+            }
+        });
+
+        int loadedPublishes = 0;
+        start = now();
+        while(now() - start < LOADED_SEC)
+        {
+            publisher.publish(makeSnapshot(devices, ++generation));
+            loadedPublishes++;
+        }
+        stop = true;
+        reader.join();
+        const double elapsed = now() - start;
+
+        printf("%5d devices: publish %.1f us; with a reader %.0f publishes/s and %.0f reads/s of %zu bytes\n",
+            devices, publishUs, loadedPublishes/elapsed, reads/elapsed, jsonLen);
+    }
+    return 0;
+}
@@ -0,0 +1,29 @@
+#!/bin/sh
+#
+# How snapshot queries slow down decoding: replays a capture as fast as it decodes, without the
+# snapshot socket, with it but idle, and with 1 and 4 clients querying back to back, e.g.
+#
+#   ./snapshotQueryBench.sh capture.iq
+#
+# Needs ../345toMqtt and ../tools/snapshotQuery built.
+#
+CAPTURE=$1
+SOCKET=/tmp/snapshotQueryBench.sock
+QUERIES=/tmp/snapshotQueryBench.out
+[ -n "$CAPTURE" ] || { echo "Usage: $0 <capture>"; exit 1; }
+
+decode() {
+    start=$(date +%s.%N)
+    ../345toMqtt -r "$CAPTURE" -o json:/dev/null "$@" > /dev/null 2>&1
+    awk "BEGIN {printf \"%.2f\", $(date +%s.%N) - $start}"
+}
+
+echo "no socket: decode $(decode)s"
+echo "idle:      decode $(decode -u $SOCKET)s"
+for clients in 1 4; do
+    ../tools/snapshotQuery $SOCKET $clients 3600 > $QUERIES &
+    seconds=$(decode -u $SOCKET)
+    wait
+    echo "$clients client(s): decode ${seconds}s, $(cat $QUERIES)"
+done
+rm -f $QUERIES
@@ -1,2 +1,2 @@
 #!/bin/sh
-g++  -o 345toMqtt -fdiagnostics-color --std=c++11 mqtt.cpp digitalDecoder.cpp analogDecoder.cpp main.cpp -lrtlsdr -lmosquittopp
+g++  -o 345toMqtt -fdiagnostics-color --std=c++11 mqtt.cpp mqtt5.cpp digitalDecoder.cpp analogDecoder.cpp freqEstimator.cpp frameTap.cpp config.cpp iqRing.cpp burstArchive.cpp realtime.cpp deviceSnapshot.cpp autoGain.cpp eventSink.cpp batchedSink.cpp rtlSdrSource.cpp rtlTcpSource.cpp fileSource.cpp archiveSource.cpp main.cpp -lrtlsdr -lmosquittopp -lmosquitto -lz -pthread -lrt
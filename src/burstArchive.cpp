@@ -0,0 +1,910 @@
+#include "burstArchive.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// Same size as the transfers librtlsdr delivers by default; larger buffers take several slots
+#define BURST_SLOT_LEN (16*32*512)
+
+// Room for the archive thread to fall behind reception, e.g. while the disk is busy
+#define BURST_RING_SEC (4)
+
+// How often the archive thread looks for new buffers
+#define BURST_POLL_MS (50)
+
+//
+// A burst is a run of blocks whose mean level is well above the noise floor, which is taken from the
+// quieter blocks of the buffers scanned.  Runs closer together than the merge time, such as the
+// repeats of one transmission, are kept as one burst, and some noise is kept either side of it so that
+// the decoder can settle before the first chip when it is replayed.
+//
+#define BURST_BLOCK_US          (500)
+#define BURST_THRESHOLD         (2.0f)      // About 6 dB over the noise floor
+#define BURST_NOISE_PERCENTILE  (0.2f)
+#define BURST_NOISE_ALPHA       (0.1f)
+#define BURST_PAD_US            (2000)
+#define BURST_MERGE_US          (10000)
+#define BURST_MAX_SEC           (2)
+
+// How stale the serials file of the open segment may get
+#define BURST_SERIALS_SEC (600)
+
+// Well beyond any rate the decoder runs at (an RTL-SDR tops out at 3.2 MS/s); a record claiming more
+// is damaged
+#define BURST_MAX_RATE (20000000)
+
+static uint32_t samplesFor(uint32_t sampleRate, uint32_t us)
+{
+    return std::max<uint32_t>((uint64_t)sampleRate*us/1000000, 1);
+}
+
+static std::string segmentPath(const std::string &dir, const std::string &day, const char *extension)
+{
+    return dir + "/" + day + extension;
+}
+
+static uint64_t entryCount(const std::string &indexPath)
+{
+    struct stat st;
+    if(stat(indexPath.c_str(), &st) < 0)
+    {
+        return 0;
+    }
+    return st.st_size/sizeof(BurstIndexEntry);
+}
+
+static bool readEntry(FILE *index, uint64_t entry, BurstIndexEntry &out)
+{
+    return fseeko(index, entry*sizeof(BurstIndexEntry), SEEK_SET) == 0 && fread(&out, sizeof(out), 1, index) == 1;
+}
+
+/* Whether a record is no bigger than a writer at its sample rate could have made it */
+static bool plausibleRecord(const BurstRecordHeader &header)
+{
+    if(header.sampleRate == 0 || header.sampleRate > BURST_MAX_RATE)
+    {
+        return false;
+    }
+
+    // A burst is cut at BURST_MAX_SEC, plus the noise before it and the block that crossed the limit,
+    // and gets at most BURST_SLOT_FRAMES frames from each ring slot it touches
+    const uint64_t maxSamples = (uint64_t)header.sampleRate*BURST_MAX_SEC + samplesFor(header.sampleRate, BURST_PAD_US + BURST_BLOCK_US);
+    const uint64_t maxFrames = (maxSamples*2/BURST_SLOT_LEN + 2)*BURST_SLOT_FRAMES;
+    return header.sampleCount <= maxSamples && header.frameCount <= maxFrames &&
+        header.compressedLen <= compressBound((uLong)header.sampleCount*2);
+}
+
+static bool readRecordHead(FILE *bursts, uint64_t offset, BurstRecordHeader &header, std::vector<BurstFrame> &frames)
+{
+    // The sizes come from the disk, so they are checked before anything is allocated for them
+    if(fseeko(bursts, offset, SEEK_SET) != 0 || fread(&header, sizeof(header), 1, bursts) != 1 ||
+        header.magic != BURST_ARCHIVE_MAGIC || header.version != BURST_ARCHIVE_VERSION || !plausibleRecord(header))
+    {
+        return false;
+    }
+
+    frames.resize(header.frameCount);
+    return frames.empty() || fread(frames.data(), sizeof(BurstFrame), frames.size(), bursts) == frames.size();
+}
+
+/* The serials of the given entries, read from their records */
+static void readSerials(FILE *index, FILE *bursts, uint64_t first, uint64_t end, std::vector<BurstSerialEntry> &serials)
+{
+    BurstIndexEntry entry;
+    BurstRecordHeader header;
+    std::vector<BurstFrame> frames;
+    for(uint64_t ii = first; ii < end; ++ii)
+    {
+        if(!readEntry(index, ii, entry) || !readRecordHead(bursts, entry.offset, header, frames))
+        {
+            continue;
+        }
+
+        const size_t firstSerial = serials.size();
+        for(const BurstFrame &frame : frames)
+        {
+            const bool seen = std::any_of(serials.begin() + firstSerial, serials.end(),
+                [&](const BurstSerialEntry &s){return s.serial == frame.serial;});
+            if(frame.crcOk && !seen)
+            {
+                serials.push_back({frame.serial, (uint32_t)ii});
+            }
+        }
+    }
+}
+
+BurstArchive::BurstArchive(const char *dir, uint32_t sampleRate, uint32_t decimation) :
+    m_dir(dir),
+    m_sampleRate(sampleRate),
+    m_decimation(decimation),
+    m_slotCount(((uint64_t)sampleRate*2*BURST_RING_SEC + BURST_SLOT_LEN - 1)/BURST_SLOT_LEN),
+    m_blockSamples(samplesFor(sampleRate, BURST_BLOCK_US)),
+    m_padSamples(samplesFor(sampleRate, BURST_PAD_US)),
+    m_mergeSamples(samplesFor(sampleRate, BURST_MERGE_US)),
+    m_maxSamples((uint64_t)sampleRate*BURST_MAX_SEC),
+    m_data((size_t)m_slotCount*BURST_SLOT_LEN),
+    m_info(m_slotCount),
+    m_frames((size_t)m_slotCount*BURST_SLOT_FRAMES),
+    m_sequences(new std::atomic<uint64_t>[m_slotCount]),
+    m_written(0)
+{
+    for(uint32_t ii = 0; ii < m_slotCount; ++ii)
+    {
+        m_sequences[ii] = 0;
+    }
+
+    std::cout << "Keeping " << m_slotCount << " buffers (" << m_data.size()/(1024*1024) << " MiB) of IQ for the burst archive in " << m_dir << std::endl;
+    m_thread = std::thread(&BurstArchive::run, this);
+}
+
+BurstArchive::~BurstArchive()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cond.notify_one();
+    m_thread.join();
+}
+
+void BurstArchive::noteFrame(uint64_t payload, bool crcOk, float signalDbfs, uint64_t endSample)
+{
+    if(m_pendingFrameCount >= BURST_SLOT_FRAMES)
+    {
+        return;
+    }
+
+    NotedFrame &noted = m_pendingFrames[m_pendingFrameCount++];
+    memset(&noted, 0, sizeof(noted));
+    noted.frame.payload = payload;
+    noted.frame.serial = (payload & 0x0FFFFF000000) >> 24;
+    noted.frame.crcOk = crcOk;
+    noted.frame.signalDbfs = signalDbfs;
+    noted.endOffset = endSample*m_decimation;
+}
+
+void BurstArchive::push(const unsigned char *buf, uint32_t len, bool burst)
+{
+    // The buffer has only just been filled, so its first sample came in one buffer's length ago
+    timeval now;
+    gettimeofday(&now, nullptr);
+    uint64_t timeUs = (uint64_t)now.tv_sec*1000000 + now.tv_usec - (uint64_t)(len/2)*1000000/m_sampleRate;
+
+    while(len > 0)
+    {
+        const uint32_t chunk = std::min<uint32_t>(len, BURST_SLOT_LEN);
+        const uint64_t n = m_written.load(std::memory_order_relaxed);
+        const uint32_t slot = n % m_slotCount;
+
+        m_sequences[slot].store(2*n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        memcpy(m_data.data() + (size_t)slot*BURST_SLOT_LEN, buf, chunk);
+        SlotInfo &info = m_info[slot];
+        info.sampleOffset = m_samplesPushed;
+        info.timeUs = timeUs;
+        info.len = chunk;
+        info.burst = burst;
+
+        // The frames go with the last part of the buffer, which is where they were decoded
+        info.frameCount = 0;
+        if(chunk == len)
+        {
+            memcpy(&m_frames[(size_t)slot*BURST_SLOT_FRAMES], m_pendingFrames, m_pendingFrameCount*sizeof(NotedFrame));
+            info.frameCount = m_pendingFrameCount;
+            m_pendingFrameCount = 0;
+        }
+
+        m_sequences[slot].store(2*n + 2, std::memory_order_release);
+        m_written.store(n + 1, std::memory_order_release);
+
+        m_samplesPushed += chunk/2;
+        timeUs += (uint64_t)(chunk/2)*1000000/m_sampleRate;
+        buf += chunk;
+        len -= chunk;
+    }
+}
+
+bool BurstArchive::copySlot(uint64_t n, SlotInfo &info, std::vector<unsigned char> &data, std::vector<NotedFrame> &frames)
+{
+    const uint32_t slot = n % m_slotCount;
+    const uint64_t before = m_sequences[slot].load(std::memory_order_acquire);
+    if(before != 2*n + 2)
+    {
+        return false;
+    }
+
+    info = m_info[slot];
+    const unsigned char *slotData = m_data.data() + (size_t)slot*BURST_SLOT_LEN;
+    data.assign(slotData, slotData + std::min<uint32_t>(info.len, BURST_SLOT_LEN));
+    const NotedFrame *slotFrames = &m_frames[(size_t)slot*BURST_SLOT_FRAMES];
+    frames.assign(slotFrames, slotFrames + std::min<uint32_t>(info.frameCount, BURST_SLOT_FRAMES));
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return m_sequences[slot].load(std::memory_order_relaxed) == before;
+}
+
+void BurstArchive::run()
+{
+    //
+    // Each buffer is looked at once the one after it is in, since a burst at the start of that one may
+    // have begun in this one
+    //
+    SlotInfo info[2];
+    std::vector<unsigned char> data[2];
+    std::vector<NotedFrame> frames[2];
+    data[0].reserve(BURST_SLOT_LEN);
+    data[1].reserve(BURST_SLOT_LEN);
+    int held = -1;
+    uint64_t heldSlot = 0;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(true)
+    {
+        const bool stop = m_stop;
+        lock.unlock();
+
+        const uint64_t written = m_written.load(std::memory_order_acquire);
+        while(m_next < written)
+        {
+            // Keep clear of the slots the callback is about to overwrite
+            const bool lapped = (written - m_next > m_slotCount - 2);
+            const int next = (held == 0) ? 1 : 0;
+            if(lapped || !copySlot(m_next, info[next], data[next], frames[next]))
+            {
+                if(held >= 0)
+                {
+                    process(heldSlot, info[held], data[held], frames[held], false);
+                }
+                held = -1;
+
+                const uint64_t resume = lapped ? (written - m_slotCount/2) : (m_next + 1);
+                m_droppedSlots += resume - m_next;
+                m_next = resume;
+                continue;
+            }
+
+            if(held >= 0)
+            {
+                process(heldSlot, info[held], data[held], frames[held], info[next].burst);
+            }
+            held = next;
+            heldSlot = m_next;
+            m_next++;
+        }
+
+        if(stop)
+        {
+            if(held >= 0)
+            {
+                process(heldSlot, info[held], data[held], frames[held], false);
+            }
+            if(m_inBurst)
+            {
+                finishBurst(m_quietSamples);
+            }
+            writeFinished(UINT64_MAX);
+            closeSegment();
+            break;
+        }
+
+        lock.lock();
+        m_cond.wait_for(lock, std::chrono::milliseconds(BURST_POLL_MS), [this]{return m_stop;});
+    }
+
+    std::cout << "Archived " << m_burstCount << " bursts, " << m_rawBytes/2 << " samples in " << m_storedBytes << " bytes";
+    if(m_droppedSlots)
+    {
+        std::cout << ", " << m_droppedSlots << " buffers dropped";
+    }
+    std::cout << std::endl;
+}
+
+void BurstArchive::process(uint64_t n, const SlotInfo &info, const std::vector<unsigned char> &data, const std::vector<NotedFrame> &frames, bool nextBurst)
+{
+    m_slotOffset = info.sampleOffset;
+    m_slotTimeUs = info.timeUs;
+
+    // Only buffers where the front end saw a burst, and the ones either side for its edges, are scanned
+    if(info.burst || m_previousBurst || nextBurst)
+    {
+        scan(n, info, data);
+    }
+    else
+    {
+        if(m_inBurst)
+        {
+            finishBurst(m_quietSamples);
+        }
+        m_carry.clear();
+        m_history.clear();
+        m_streamOffset = info.sampleOffset + info.len/2;
+    }
+    m_previousBurst = info.burst;
+
+    place(frames);
+    writeFinished(n);
+}
+
+void BurstArchive::scan(uint64_t n, const SlotInfo &info, const std::vector<unsigned char> &data)
+{
+    // Buffers went missing in between
+    if(info.sampleOffset != m_streamOffset)
+    {
+        if(m_inBurst)
+        {
+            finishBurst(m_quietSamples);
+        }
+        m_carry.clear();
+        m_history.clear();
+    }
+    m_streamOffset = info.sampleOffset + data.size()/2;
+
+    // Blocks straddle buffers, so the end of the last one goes first
+    std::vector<unsigned char> &work = m_carry;
+    work.insert(work.end(), data.begin(), data.end());
+    const uint64_t workOffset = m_streamOffset - work.size()/2;
+    const size_t blockBytes = (size_t)m_blockSamples*2;
+    const size_t blockCount = work.size()/blockBytes;
+
+    m_levels.resize(blockCount);
+    for(size_t ii = 0; ii < blockCount; ++ii)
+    {
+        const unsigned char *block = work.data() + ii*blockBytes;
+        uint32_t level = 0;
+        for(size_t jj = 0; jj < blockBytes; ++jj)
+        {
+            level += std::abs(2*(int)block[jj] - 255);
+        }
+        m_levels[ii] = level;
+    }
+
+    // Most of any buffer is noise, so its quieter blocks give the noise floor
+    if(blockCount >= 4)
+    {
+        std::vector<uint32_t> sorted(m_levels);
+        auto percentile = sorted.begin() + (size_t)(blockCount*BURST_NOISE_PERCENTILE);
+        std::nth_element(sorted.begin(), percentile, sorted.end());
+        m_noiseLevel = (m_noiseLevel > 0.0f) ? (m_noiseLevel + BURST_NOISE_ALPHA*(*percentile - m_noiseLevel)) : *percentile;
+    }
+    const float threshold = std::max(m_noiseLevel, (float)blockBytes)*BURST_THRESHOLD;
+
+    for(size_t ii = 0; ii < blockCount; ++ii)
+    {
+        const unsigned char *block = work.data() + ii*blockBytes;
+        const bool hot = m_levels[ii] > threshold;
+
+        if(hot && !m_inBurst)
+        {
+            m_inBurst = true;
+            m_burst.sampleOffset = workOffset + ii*m_blockSamples - m_history.size()/2;
+            m_burst.timeUs = m_slotTimeUs + ((int64_t)m_burst.sampleOffset - (int64_t)m_slotOffset)*1000000/(int64_t)m_sampleRate;
+            m_burst.iq.assign(m_history.begin(), m_history.end());
+            m_burst.frames.clear();
+            m_history.clear();
+        }
+
+        if(m_inBurst)
+        {
+            m_burst.iq.insert(m_burst.iq.end(), block, block + blockBytes);
+            m_burst.lastSlot = n;
+            if(hot)
+            {
+                m_quietSamples = 0;
+                if(m_burst.iq.size()/2 >= m_maxSamples)
+                {
+                    finishBurst(0);
+                }
+            }
+            else
+            {
+                m_quietSamples += m_blockSamples;
+                if(m_quietSamples >= m_mergeSamples)
+                {
+                    finishBurst(m_quietSamples);
+                }
+            }
+        }
+        else
+        {
+            // Keep the noise a burst would start with
+            m_history.insert(m_history.end(), block, block + blockBytes);
+            if(m_history.size() > (size_t)m_padSamples*2)
+            {
+                m_history.erase(m_history.begin(), m_history.end() - (size_t)m_padSamples*2);
+            }
+        }
+    }
+
+    work.erase(work.begin(), work.begin() + blockCount*blockBytes);
+}
+
+void BurstArchive::finishBurst(uint64_t trailingQuiet)
+{
+    // The noise at the end may lead into the next burst
+    const size_t historyLen = std::min(m_burst.iq.size(), (size_t)m_padSamples*2);
+    m_history.assign(m_burst.iq.end() - historyLen, m_burst.iq.end());
+
+    const uint64_t trim = (trailingQuiet > m_padSamples) ? (trailingQuiet - m_padSamples) : 0;
+    m_burst.iq.resize(m_burst.iq.size() - std::min<size_t>(trim*2, m_burst.iq.size()));
+
+    m_finished.push_back(std::move(m_burst));
+    m_burst = Burst();
+    m_inBurst = false;
+    m_quietSamples = 0;
+}
+
+void BurstArchive::place(const std::vector<NotedFrame> &frames)
+{
+    //
+    // A frame is decoded a few chips after it ends, by when the burst it came in may have ended too, and
+    // another may have begun.  A frame outside every burst, e.g. one the energy detector missed, is
+    // left out.
+    //
+    for(const NotedFrame &noted : frames)
+    {
+        Burst *burst = nullptr;
+        if(m_inBurst && noted.endOffset >= m_burst.sampleOffset)
+        {
+            burst = &m_burst;
+        }
+        for(auto finished = m_finished.rbegin(); !burst && finished != m_finished.rend(); ++finished)
+        {
+            if(noted.endOffset >= finished->sampleOffset && noted.endOffset < finished->sampleOffset + finished->iq.size()/2)
+            {
+                burst = &*finished;
+            }
+        }
+
+        if(burst)
+        {
+            burst->frames.push_back(noted.frame);
+            burst->frames.back().endSample = noted.endOffset - burst->sampleOffset;
+        }
+    }
+}
+
+void BurstArchive::writeFinished(uint64_t beforeSlot)
+{
+    // Bursts that ended in this buffer can still get frames decoded in the next one
+    auto end = m_finished.begin();
+    while(end != m_finished.end() && end->lastSlot < beforeSlot)
+    {
+        write(*end);
+        ++end;
+    }
+    m_finished.erase(m_finished.begin(), end);
+}
+
+void BurstArchive::write(const Burst &burst)
+{
+    if(burst.iq.empty())
+    {
+        return;
+    }
+
+    const time_t seconds = burst.timeUs/1000000;
+    tm utc;
+    gmtime_r(&seconds, &utc);
+    char day[16];
+    strftime(day, sizeof(day), "%Y%m%d", &utc);
+    if(day != m_day)
+    {
+        closeSegment();
+        if(!openSegment(day))
+        {
+            return;
+        }
+    }
+
+    uLongf packedLen = compressBound(burst.iq.size());
+    std::vector<unsigned char> packed(packedLen);
+    if(compress2(packed.data(), &packedLen, burst.iq.data(), burst.iq.size(), Z_BEST_SPEED) != Z_OK)
+    {
+        std::cout << "Failed to compress a burst" << std::endl;
+        return;
+    }
+
+    BurstRecordHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = BURST_ARCHIVE_MAGIC;
+    header.version = BURST_ARCHIVE_VERSION;
+    header.frameCount = std::min<size_t>(burst.frames.size(), UINT16_MAX);
+    header.sampleOffset = burst.sampleOffset;
+    header.timeUs = burst.timeUs;
+    header.sampleRate = m_sampleRate;
+    header.sampleCount = burst.iq.size()/2;
+    header.compressedLen = packedLen;
+
+    //
+    // The record goes out before its index entry, so that an entry never points past what made it to
+    // the disk
+    //
+    const bool recordWritten = fwrite(&header, sizeof(header), 1, m_bursts) == 1 &&
+        fwrite(burst.frames.data(), sizeof(BurstFrame), header.frameCount, m_bursts) == header.frameCount &&
+        fwrite(packed.data(), 1, packedLen, m_bursts) == packedLen &&
+        fflush(m_bursts) == 0;
+    if(!recordWritten)
+    {
+        std::cout << "Failed to write " << segmentPath(m_dir, m_day, ".bursts") << ": " << strerror(errno) << std::endl;
+        fseeko(m_bursts, 0, SEEK_END);
+        m_burstsSize = ftello(m_bursts);
+        return;
+    }
+
+    const BurstIndexEntry entry = {std::max(burst.timeUs, m_lastIndexTimeUs), m_burstsSize};
+    m_burstsSize += sizeof(header) + header.frameCount*sizeof(BurstFrame) + packedLen;
+    if(fwrite(&entry, sizeof(entry), 1, m_index) != 1 || fflush(m_index) != 0)
+    {
+        std::cout << "Failed to write " << segmentPath(m_dir, m_day, ".index") << ": " << strerror(errno) << std::endl;
+        return;
+    }
+
+    const size_t firstSerial = m_serials.size();
+    for(const BurstFrame &frame : burst.frames)
+    {
+        const bool seen = std::any_of(m_serials.begin() + firstSerial, m_serials.end(),
+            [&](const BurstSerialEntry &s){return s.serial == frame.serial;});
+        if(frame.crcOk && !seen)
+        {
+            m_serials.push_back({frame.serial, (uint32_t)m_entries});
+        }
+    }
+
+    m_entries++;
+    m_lastIndexTimeUs = entry.timeUs;
+    m_burstCount++;
+    m_rawBytes += burst.iq.size();
+    m_storedBytes += sizeof(header) + header.frameCount*sizeof(BurstFrame) + packedLen + sizeof(entry);
+
+    if(time(nullptr) - m_serialsTime >= BURST_SERIALS_SEC)
+    {
+        writeSerials();
+    }
+}
+
+bool BurstArchive::openSegment(const std::string &day)
+{
+    const std::string burstsPath = segmentPath(m_dir, day, ".bursts");
+    const std::string indexPath = segmentPath(m_dir, day, ".index");
+
+    // Carry on with a segment from an earlier run, less any index entry a crash cut short
+    m_entries = entryCount(indexPath);
+    if(truncate(indexPath.c_str(), m_entries*sizeof(BurstIndexEntry)) < 0 && errno != ENOENT)
+    {
+        std::cout << "Failed to truncate " << indexPath << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    m_bursts = fopen(burstsPath.c_str(), "ab");
+    m_index = fopen(indexPath.c_str(), "ab");
+    if(!m_bursts || !m_index)
+    {
+        std::cout << "Failed to open " << (m_bursts ? indexPath : burstsPath) << ": " << strerror(errno) << std::endl;
+        if(m_bursts)
+        {
+            fclose(m_bursts);
+        }
+        if(m_index)
+        {
+            fclose(m_index);
+        }
+        m_bursts = m_index = nullptr;
+        return false;
+    }
+    fseeko(m_bursts, 0, SEEK_END);
+    m_burstsSize = ftello(m_bursts);
+    m_day = day;
+
+    //
+    // Pick up the serials of the earlier run: those in its serials file, and those it wrote after that
+    // from the records themselves
+    //
+    m_serials.clear();
+    m_lastIndexTimeUs = 0;
+    uint64_t covered = 0;
+    FILE *serials = fopen(segmentPath(m_dir, day, ".serials").c_str(), "rb");
+    if(serials)
+    {
+        BurstSerialHeader header;
+        if(fread(&header, sizeof(header), 1, serials) == 1 && header.magic == BURST_ARCHIVE_MAGIC && header.entries <= m_entries)
+        {
+            BurstSerialEntry entry;
+            while(fread(&entry, sizeof(entry), 1, serials) == 1)
+            {
+                m_serials.push_back(entry);
+            }
+            covered = header.entries;
+        }
+        fclose(serials);
+    }
+
+    if(m_entries > 0)
+    {
+        FILE *index = fopen(indexPath.c_str(), "rb");
+        FILE *bursts = fopen(burstsPath.c_str(), "rb");
+        BurstIndexEntry last;
+        if(index && bursts)
+        {
+            readSerials(index, bursts, covered, m_entries, m_serials);
+            if(readEntry(index, m_entries - 1, last))
+            {
+                m_lastIndexTimeUs = last.timeUs;
+            }
+        }
+        if(index)
+        {
+            fclose(index);
+        }
+        if(bursts)
+        {
+            fclose(bursts);
+        }
+    }
+    m_serialsWritten = covered;
+    m_serialsTime = time(nullptr);
+
+    std::cout << "Archiving bursts to " << burstsPath << " (" << m_entries << " already there)" << std::endl;
+    return true;
+}
+
+void BurstArchive::closeSegment()
+{
+    if(!m_bursts)
+    {
+        return;
+    }
+
+    writeSerials();
+    fclose(m_bursts);
+    fclose(m_index);
+    m_bursts = m_index = nullptr;
+    m_day.clear();
+    m_serials.clear();
+}
+
+void BurstArchive::writeSerials()
+{
+    m_serialsTime = time(nullptr);
+    if(m_serialsWritten == m_entries)
+    {
+        return;
+    }
+
+    std::sort(m_serials.begin(), m_serials.end(), [](const BurstSerialEntry &a, const BurstSerialEntry &b)
+    {
+        return (a.serial != b.serial) ? (a.serial < b.serial) : (a.entry < b.entry);
+    });
+
+    // Readers never see half a file
+    const std::string path = segmentPath(m_dir, m_day, ".serials");
+    const std::string tempPath = path + ".tmp";
+    FILE *file = fopen(tempPath.c_str(), "wb");
+    if(!file)
+    {
+        std::cout << "Failed to open " << tempPath << ": " << strerror(errno) << std::endl;
+        return;
+    }
+
+    const BurstSerialHeader header = {BURST_ARCHIVE_MAGIC, BURST_ARCHIVE_VERSION, m_entries};
+    const bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(m_serials.data(), sizeof(BurstSerialEntry), m_serials.size(), file) == m_serials.size();
+    if(fclose(file) != 0 || !written || rename(tempPath.c_str(), path.c_str()) < 0)
+    {
+        std::cout << "Failed to write " << path << ": " << strerror(errno) << std::endl;
+        unlink(tempPath.c_str());
+        return;
+    }
+    m_serialsWritten = m_entries;
+}
+
+bool BurstArchiveReader::open(const char *dir)
+{
+    m_dir = dir;
+    m_days.clear();
+
+    DIR *d = opendir(dir);
+    if(!d)
+    {
+        std::cout << "Failed to open " << m_dir << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Segments are named after their day, so sorting the names puts them in time order
+    while(dirent *entry = readdir(d))
+    {
+        const std::string name = entry->d_name;
+        if(name.size() == 14 && name.compare(8, 6, ".index") == 0 &&
+            std::all_of(name.begin(), name.begin() + 8, [](char c){return c >= '0' && c <= '9';}))
+        {
+            m_days.push_back(name.substr(0, 8));
+        }
+    }
+    closedir(d);
+    std::sort(m_days.begin(), m_days.end());
+
+    return true;
+}
+
+std::vector<BurstArchiveReader::Location> BurstArchiveReader::findByTime(uint64_t fromUs, uint64_t toUs) const
+{
+    std::vector<Location> found;
+    for(const std::string &day : m_days)
+    {
+        tm utc = {};
+        sscanf(day.c_str(), "%4d%2d%2d", &utc.tm_year, &utc.tm_mon, &utc.tm_mday);
+        utc.tm_year -= 1900;
+        utc.tm_mon -= 1;
+        const uint64_t dayStartUs = (uint64_t)timegm(&utc)*1000000;
+        if(dayStartUs >= toUs || dayStartUs + 86400ull*1000000 <= fromUs)
+        {
+            continue;
+        }
+
+        const std::string indexPath = segmentPath(m_dir, day, ".index");
+        FILE *index = fopen(indexPath.c_str(), "rb");
+        if(!index)
+        {
+            continue;
+        }
+
+        // The first entries at or after each end of the range
+        const uint64_t count = entryCount(indexPath);
+        uint64_t bounds[2];
+        const uint64_t times[2] = {fromUs, toUs};
+        for(int ii = 0; ii < 2; ++ii)
+        {
+            uint64_t low = 0;
+            uint64_t high = count;
+            BurstIndexEntry entry;
+            while(low < high)
+            {
+                const uint64_t mid = low + (high - low)/2;
+                if(readEntry(index, mid, entry) && entry.timeUs < times[ii])
+                {
+                    low = mid + 1;
+                }
+                else
+                {
+                    high = mid;
+                }
+            }
+            bounds[ii] = low;
+        }
+
+        BurstIndexEntry entry;
+        for(uint64_t ii = bounds[0]; ii < bounds[1] && readEntry(index, ii, entry); ++ii)
+        {
+            found.push_back({day, ii, entry.offset, entry.timeUs});
+        }
+        fclose(index);
+    }
+
+    return found;
+}
+
+std::vector<BurstArchiveReader::Location> BurstArchiveReader::findBySerial(uint32_t serial) const
+{
+    std::vector<Location> found;
+    for(const std::string &day : m_days)
+    {
+        const std::string indexPath = segmentPath(m_dir, day, ".index");
+        FILE *index = fopen(indexPath.c_str(), "rb");
+        FILE *bursts = fopen(segmentPath(m_dir, day, ".bursts").c_str(), "rb");
+        FILE *serials = fopen(segmentPath(m_dir, day, ".serials").c_str(), "rb");
+        const uint64_t count = entryCount(indexPath);
+
+        std::vector<uint64_t> entries;
+        uint64_t covered = 0;
+        BurstSerialHeader header;
+        if(serials && fread(&header, sizeof(header), 1, serials) == 1 && header.magic == BURST_ARCHIVE_MAGIC)
+        {
+            struct stat st;
+            fstat(fileno(serials), &st);
+            const uint64_t serialCount = (st.st_size - sizeof(header))/sizeof(BurstSerialEntry);
+            covered = std::min<uint64_t>(header.entries, count);
+
+            // First entry for the serial; the rest follow it
+            uint64_t low = 0;
+            uint64_t high = serialCount;
+            BurstSerialEntry entry;
+            while(low < high)
+            {
+                const uint64_t mid = low + (high - low)/2;
+                if(fseeko(serials, sizeof(header) + mid*sizeof(entry), SEEK_SET) == 0 &&
+                    fread(&entry, sizeof(entry), 1, serials) == 1 && entry.serial < serial)
+                {
+                    low = mid + 1;
+                }
+                else
+                {
+                    high = mid;
+                }
+            }
+
+            fseeko(serials, sizeof(header) + low*sizeof(entry), SEEK_SET);
+            while(fread(&entry, sizeof(entry), 1, serials) == 1 && entry.serial == serial)
+            {
+                if(entry.entry < covered)
+                {
+                    entries.push_back(entry.entry);
+                }
+            }
+        }
+
+        // Whatever was written since the serials file was
+        if(index && bursts)
+        {
+            std::vector<BurstSerialEntry> recent;
+            readSerials(index, bursts, covered, count, recent);
+            for(const BurstSerialEntry &entry : recent)
+            {
+                if(entry.serial == serial)
+                {
+                    entries.push_back(entry.entry);
+                }
+            }
+        }
+
+        BurstIndexEntry entry;
+        for(uint64_t ii : entries)
+        {
+            if(index && readEntry(index, ii, entry))
+            {
+                found.push_back({day, ii, entry.offset, entry.timeUs});
+            }
+        }
+
+        for(FILE *file : {index, bursts, serials})
+        {
+            if(file)
+            {
+                fclose(file);
+            }
+        }
+    }
+
+    return found;
+}
+
+bool BurstArchiveReader::read(const Location &location, BurstRecordHeader &header, std::vector<BurstFrame> &frames, std::vector<unsigned char> &iq) const
+{
+    const std::string path = segmentPath(m_dir, location.day, ".bursts");
+    FILE *bursts = fopen(path.c_str(), "rb");
+    if(!bursts)
+    {
+        std::cout << "Failed to open " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    std::vector<unsigned char> packed;
+    bool valid = readRecordHead(bursts, location.offset, header, frames);
+    if(valid)
+    {
+        packed.resize(header.compressedLen);
+        valid = fread(packed.data(), 1, packed.size(), bursts) == packed.size();
+    }
+    fclose(bursts);
+
+    if(valid)
+    {
+        uLongf len = (uLongf)header.sampleCount*2;
+        iq.resize(len);
+        valid = uncompress(iq.data(), &len, packed.data(), packed.size()) == Z_OK && len == iq.size();
+    }
+    if(!valid)
+    {
+        std::cout << "Burst " << location.entry << " of " << path << " is damaged" << std::endl;
+    }
+
+    return valid;
+}
@@ -0,0 +1,227 @@
+#ifndef __BURST_ARCHIVE_H__
+#define __BURST_ARCHIVE_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//
+// Long-term raw IQ history that only keeps the bursts, for looking back at what a receiver heard
+// weeks later without filling the disk with noise.
+//
+// The archive is a directory with one segment per UTC day, each made of three files:
+//
+//  - YYYYMMDD.bursts: the bursts, one record after another.  A record is a BurstRecordHeader, the
+//    frames decoded from the burst, then the burst's 8-bit IQ deflated.
+//  - YYYYMMDD.index: one BurstIndexEntry per record, in the order they were written, which is also
+//    time order, so that a time is found by binary search.
+//  - YYYYMMDD.serials: a BurstSerialHeader, then a BurstSerialEntry for every serial decoded in every
+//    record, sorted by serial, so that a serial is found by binary search too.  It is rewritten every
+//    few minutes and when the segment closes; records written since then are found by reading them.
+//
+// All numbers are in the writer's byte order.
+//
+
+#define BURST_ARCHIVE_MAGIC   0x54535242u  // "BRST"
+#define BURST_ARCHIVE_VERSION 1
+
+// Frames kept with one receive buffer; any more decoded from it are left out of the archive
+#define BURST_SLOT_FRAMES 8
+
+struct BurstRecordHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t frameCount;
+    uint64_t sampleOffset;      // Of the first sample, counted from when reception started
+    uint64_t timeUs;            // Wall clock of the first sample, microseconds since the epoch
+    uint32_t sampleRate;
+    uint32_t sampleCount;
+    uint32_t compressedLen;     // Deflated IQ after the frames
+    uint32_t reserved;
+};
+
+struct BurstFrame
+{
+    uint64_t payload;           // Including the sync bits
+    uint32_t serial;
+    uint8_t crcOk;
+    uint8_t reserved[3];
+    float signalDbfs;           // Mean level of the frame's high chips
+    uint32_t endSample;         // Where the frame ended, counted from the burst's first sample
+};
+
+struct BurstIndexEntry
+{
+    uint64_t timeUs;            // Never less than the entry before, even if the clock stepped back
+    uint64_t offset;            // Of the record in the .bursts file
+};
+
+struct BurstSerialHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t entries;           // Index entries the serials below cover
+};
+
+struct BurstSerialEntry
+{
+    uint32_t serial;
+    uint32_t entry;
+};
+
+//
+// Writes the archive as reception goes.
+//
+// The receive callback copies each buffer into a preallocated ring, together with whether the front
+// end saw a burst in it and the frames decoded from it, and does nothing else.  A background thread
+// looks for energy in those buffers and the ones either side of them, cuts out each burst with a
+// little of the noise around it, deflates it and appends it to the day's segment.  As with IqRing, a
+// buffer the callback overwrote before the thread got to it is dropped rather than waited for.
+//
+class BurstArchive
+{
+  public:
+    // The decoder counts samples after decimation, and the archive before
+    BurstArchive(const char *dir, uint32_t sampleRate, uint32_t decimation);
+    ~BurstArchive();
+
+    // From the decoder, with the decimated sample the frame ended at
+    void noteFrame(uint64_t payload, bool crcOk, float signalDbfs, uint64_t endSample);
+
+    // From the receive callback, once it is done with the buffer
+    void push(const unsigned char *buf, uint32_t len, bool burst);
+
+  private:
+    struct NotedFrame
+    {
+        BurstFrame frame;
+        uint64_t endOffset;     // Samples since reception started
+    };
+
+    struct SlotInfo
+    {
+        uint64_t sampleOffset;
+        uint64_t timeUs;
+        uint32_t len;
+        uint32_t frameCount;
+        bool burst;
+    };
+
+    struct Burst
+    {
+        uint64_t sampleOffset;
+        uint64_t timeUs;
+        uint64_t lastSlot;      // Last buffer it took samples from
+        std::vector<unsigned char> iq;
+        std::vector<BurstFrame> frames;
+    };
+
+    void run();
+    bool copySlot(uint64_t n, SlotInfo &info, std::vector<unsigned char> &data, std::vector<NotedFrame> &frames);
+    void process(uint64_t n, const SlotInfo &info, const std::vector<unsigned char> &data, const std::vector<NotedFrame> &frames, bool nextBurst);
+    void scan(uint64_t n, const SlotInfo &info, const std::vector<unsigned char> &data);
+    void finishBurst(uint64_t trailingQuiet);
+    void place(const std::vector<NotedFrame> &frames);
+    void writeFinished(uint64_t beforeSlot);
+    void write(const Burst &burst);
+
+    bool openSegment(const std::string &day);
+    void closeSegment();
+    void writeSerials();
+
+    const std::string m_dir;
+    const uint32_t m_sampleRate;
+    const uint32_t m_decimation;
+    const uint32_t m_slotCount;
+    const uint32_t m_blockSamples;
+    const uint32_t m_padSamples;
+    const uint32_t m_mergeSamples;
+    const uint64_t m_maxSamples;
+
+    // Written by the callback, read by the thread
+    std::vector<unsigned char> m_data;
+    std::vector<SlotInfo> m_info;
+    std::vector<NotedFrame> m_frames;
+    std::unique_ptr<std::atomic<uint64_t>[]> m_sequences;
+    std::atomic<uint64_t> m_written;
+
+    // Only touched by the callback and decoder
+    uint64_t m_samplesPushed = 0;
+    NotedFrame m_pendingFrames[BURST_SLOT_FRAMES];
+    uint32_t m_pendingFrameCount = 0;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_stop = false;
+    std::thread m_thread;
+
+    // Everything below belongs to the thread
+    uint64_t m_next = 0;
+    bool m_previousBurst = false;
+    float m_noiseLevel = 0.0f;
+    uint64_t m_streamOffset = 0;
+    std::vector<unsigned char> m_carry;
+    std::vector<unsigned char> m_history;
+    std::vector<uint32_t> m_levels;
+
+    bool m_inBurst = false;
+    uint64_t m_quietSamples = 0;
+    uint64_t m_slotOffset = 0;
+    uint64_t m_slotTimeUs = 0;
+    Burst m_burst;
+    std::vector<Burst> m_finished;
+
+    std::string m_day;
+    FILE *m_bursts = nullptr;
+    FILE *m_index = nullptr;
+    uint64_t m_burstsSize = 0;
+    uint64_t m_entries = 0;
+    uint64_t m_lastIndexTimeUs = 0;
+    std::vector<BurstSerialEntry> m_serials;
+    uint64_t m_serialsWritten = 0;
+    time_t m_serialsTime = 0;
+
+    uint64_t m_burstCount = 0;
+    uint64_t m_rawBytes = 0;
+    uint64_t m_storedBytes = 0;
+    uint64_t m_droppedSlots = 0;
+};
+
+//
+// Finds and reads bursts in an archive, possibly while it is being written
+//
+class BurstArchiveReader
+{
+  public:
+    struct Location
+    {
+        std::string day;
+        uint64_t entry;
+        uint64_t offset;
+        uint64_t timeUs;            // The index's time, which is what the time range is searched by
+    };
+
+    bool open(const char *dir);
+
+    // Bursts whose first sample is in [fromUs, toUs), in time order
+    std::vector<Location> findByTime(uint64_t fromUs, uint64_t toUs) const;
+
+    // Bursts holding a valid frame from the serial, in time order
+    std::vector<Location> findBySerial(uint32_t serial) const;
+
+    bool read(const Location &location, BurstRecordHeader &header, std::vector<BurstFrame> &frames, std::vector<unsigned char> &iq) const;
+
+  private:
+    std::string m_dir;
+    std::vector<std::string> m_days;
+};
+
+#endif
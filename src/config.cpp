@@ -0,0 +1,172 @@
+#include "config.h"
+#include "mqtt_config.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+Config::Config() :
+    mqttHost(MQTT_HOST),
+    mqttPort(MQTT_PORT),
+    mqttUsername(MQTT_USERNAME),
+    mqttPassword(MQTT_PASSWORD),
+    baseTopic("security/sensors345/"),
+    openSensorMsg(OPEN_SENSOR_MSG),
+    closedSensorMsg(CLOSED_SENSOR_MSG),
+    tamperMsg(TAMPER_MSG),
+    untamperedMsg(UNTAMPERED_MSG),
+    lowBatMsg(LOW_BAT_MSG),
+    okBatMsg(OK_BAT_MSG),
+    frequency(345000000),
+    gain(364),
+    agc(0),
+    autoGain(false),
+    mqtt5Expiry(1),
+    mqtt5Properties(0)
+{
+}
+
+bool Config::sameBroker(const Config &other) const
+{
+    return mqttHost == other.mqttHost
+        && mqttPort == other.mqttPort
+        && mqttUsername == other.mqttUsername
+        && mqttPassword == other.mqttPassword
+        && baseTopic == other.baseTopic;
+}
+
+static std::string trim(const std::string &str)
+{
+    const char *whitespace = " \t\r\n";
+    size_t first = str.find_first_not_of(whitespace);
+    if(first == std::string::npos)
+    {
+        return "";
+    }
+    size_t last = str.find_last_not_of(whitespace);
+    return str.substr(first, last - first + 1);
+}
+
+// Comma or space separated serials, in decimal as they appear in the topics
+static bool parseSerials(const std::string &value, std::vector<uint32_t> &result)
+{
+    std::vector<uint32_t> serials;
+    const char *pos = value.c_str();
+    while(*pos)
+    {
+        if(*pos == ',' || *pos == ' ' || *pos == '\t')
+        {
+            pos++;
+            continue;
+        }
+
+        char *end;
+        unsigned long serial = strtoul(pos, &end, 10);
+        if(end == pos || serial > 0xFFFFF)
+        {
+            return false;
+        }
+        serials.push_back(serial);
+        pos = end;
+    }
+    result = serials;
+    return true;
+}
+
+static bool parseInt(const std::string &value, int &result)
+{
+    char *end;
+    long parsed = strtol(value.c_str(), &end, 10);
+    if(value.empty() || *end != '\0')
+    {
+        return false;
+    }
+    result = parsed;
+    return true;
+}
+
+bool loadConfig(const char *path, Config &config)
+{
+    std::ifstream file(path);
+    if(!file)
+    {
+        std::cout << "Failed to open config file " << path << std::endl;
+        return false;
+    }
+
+    Config loaded(config);
+    std::string line;
+    int lineNumber = 0;
+    bool ok = true;
+
+    while(std::getline(file, line))
+    {
+        lineNumber++;
+
+        line = trim(line.substr(0, line.find('#')));
+        if(line.empty())
+        {
+            continue;
+        }
+
+        size_t equals = line.find('=');
+        if(equals == std::string::npos)
+        {
+            std::cout << path << ":" << lineNumber << ": expected key = value" << std::endl;
+            ok = false;
+            continue;
+        }
+
+        const std::string key = trim(line.substr(0, equals));
+        const std::string value = trim(line.substr(equals + 1));
+
+        bool valid = true;
+        if(key == "mqtt_host")                  loaded.mqttHost = value;
+        else if(key == "mqtt_port")             valid = parseInt(value, loaded.mqttPort);
+        else if(key == "mqtt_username")         loaded.mqttUsername = value;
+        else if(key == "mqtt_password")         loaded.mqttPassword = value;
+        else if(key == "base_topic")            loaded.baseTopic = value;
+        else if(key == "open_sensor_msg")       loaded.openSensorMsg = value;
+        else if(key == "closed_sensor_msg")     loaded.closedSensorMsg = value;
+        else if(key == "tamper_msg")            loaded.tamperMsg = value;
+        else if(key == "untampered_msg")        loaded.untamperedMsg = value;
+        else if(key == "low_bat_msg")           loaded.lowBatMsg = value;
+        else if(key == "ok_bat_msg")            loaded.okBatMsg = value;
+        else if(key == "frequency")             valid = parseInt(value, loaded.frequency);
+        else if(key == "gain")
+        {
+            loaded.autoGain = (value == "auto");
+            valid = loaded.autoGain || parseInt(value, loaded.gain);
+        }
+        else if(key == "agc")                   valid = parseInt(value, loaded.agc);
+        else if(key == "mqtt5_expiry")          valid = parseInt(value, loaded.mqtt5Expiry);
+        else if(key == "mqtt5_properties")      valid = parseInt(value, loaded.mqtt5Properties);
+        else if(key == "capture_serials")       valid = parseSerials(value, loaded.captureSerials);
+        else
+        {
+            std::cout << path << ":" << lineNumber << ": unknown key " << key << std::endl;
+            ok = false;
+            continue;
+        }
+
+        if(!valid)
+        {
+            std::cout << path << ":" << lineNumber << ": bad value for " << key << std::endl;
+            ok = false;
+        }
+    }
+
+    if(!ok)
+    {
+        return false;
+    }
+
+    // Topics are built by appending to the base
+    if(!loaded.baseTopic.empty() && loaded.baseTopic[loaded.baseTopic.size() - 1] != '/')
+    {
+        loaded.baseTopic += '/';
+    }
+
+    config = loaded;
+    return true;
+}
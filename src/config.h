@@ -0,0 +1,53 @@
+#ifndef __CONFIG_H__
+#define __CONFIG_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+//
+// Settings that can be changed at runtime.  They start out from mqtt_config.h, are overridden by
+// the MQTT_* environment variables and command line flags, and then by the config file, which is
+// read again on SIGHUP.
+//
+struct Config
+{
+    std::string mqttHost;
+    int mqttPort;
+    std::string mqttUsername;
+    std::string mqttPassword;
+
+    std::string baseTopic;
+    std::string openSensorMsg;
+    std::string closedSensorMsg;
+    std::string tamperMsg;
+    std::string untamperedMsg;
+    std::string lowBatMsg;
+    std::string okBatMsg;
+
+    int frequency;
+    int gain;
+    int agc;
+
+    // "gain = auto": picked from the measured noise floor and frame margins instead (see autoGain.h).
+    // gain is then only where calibration starts from.
+    bool autoGain;
+
+    // With -o mqtt5, supervision refreshes expire once the sensor would count as lost (on by default),
+    // and the first field published for a sensor frame carries rssi and timestamp_us user properties
+    // (off by default, as they cost bytes on every frame).
+    int mqtt5Expiry;
+    int mqtt5Properties;
+
+    // Serials whose frames are always saved as raw IQ when capturing is enabled
+    std::vector<uint32_t> captureSerials;
+
+    Config();
+    bool sameBroker(const Config &other) const;
+};
+
+// Applies the "key = value" lines of the file on top of config.  Keys that aren't in the file keep
+// their value.  Returns false, leaving config untouched, if the file can't be read or has errors.
+bool loadConfig(const char *path, Config &config);
+
+#endif
@@ -0,0 +1,205 @@
+#include "deviceSnapshot.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// A client that doesn't take its document within this long is dropped
+#define SNAPSHOT_SEND_TIMEOUT_SEC (1)
+
+static void appendSupervision(std::string &json, bool lost)
+{
+    json += ",\"supervision\":";
+    json += lost ? "\"LOST\"" : "\"OK\"";
+}
+
+std::string DeviceSnapshot::toJson(time_t now) const
+{
+    std::string json("{\"generation\":");
+    json += std::to_string(generation);
+    json += ",\"time\":";
+    json += std::to_string(createdTime);
+
+    json += ",\"sensors\":[";
+    for(size_t ii = 0; ii < sensors.size(); ++ii)
+    {
+        const Sensor &sensor = sensors[ii];
+        json += (ii ? ",{\"serial\":" : "{\"serial\":");
+        json += std::to_string(sensor.serial);
+        json += ",\"loop1\":";
+        json += sensor.loop1 ? "true" : "false";
+        json += ",\"loop2\":";
+        json += sensor.loop2 ? "true" : "false";
+        json += ",\"loop3\":";
+        json += sensor.loop3 ? "true" : "false";
+        json += ",\"tamper\":";
+        json += sensor.tamper ? "true" : "false";
+        json += ",\"low_battery\":";
+        json += sensor.lowBat ? "true" : "false";
+        json += ",\"last_seen\":";
+        json += std::to_string(sensor.lastUpdateTime);
+        appendSupervision(json, sensor.hasLostSupervision || (now - sensor.lastUpdateTime) > supervisionTimeoutSec);
+        json += '}';
+    }
+
+    json += "],\"keypads\":[";
+    for(size_t ii = 0; ii < keypads.size(); ++ii)
+    {
+        const Keypad &keypad = keypads[ii];
+        json += (ii ? ",{\"serial\":" : "{\"serial\":");
+        json += std::to_string(keypad.serial);
+        json += ",\"low_battery\":";
+        json += keypad.lowBat ? "true" : "false";
+        json += ",\"last_seen\":";
+        json += std::to_string(keypad.lastUpdateTime);
+        appendSupervision(json, keypad.hasLostSupervision || (now - keypad.lastUpdateTime) > supervisionTimeoutSec);
+        json += '}';
+    }
+    json += "]}\n";
+
+    return json;
+}
+
+SnapshotPublisher::~SnapshotPublisher()
+{
+    for(const DeviceSnapshot *snapshot : m_retired)
+    {
+        delete snapshot;
+    }
+    for(const DeviceSnapshot *snapshot : m_expiring)
+    {
+        delete snapshot;
+    }
+    delete m_current.load();
+}
+
+void SnapshotPublisher::publish(const DeviceSnapshot *snapshot)
+{
+    const DeviceSnapshot *previous = m_current.exchange(snapshot);
+    if(previous)
+    {
+        m_retired.push_back(previous);
+    }
+
+    //
+    // Whoever loaded a snapshot that was replaced before the last epoch change counted themselves
+    // under the previous parity.  Anyone still to count themselves there will load a newer one.
+    //
+    const uint32_t epoch = m_epoch.load();
+    if(m_readers[(epoch - 1) & 1].load() == 0)
+    {
+        for(const DeviceSnapshot *expired : m_expiring)
+        {
+            delete expired;
+        }
+        m_expiring.clear();
+        m_expiring.swap(m_retired);
+        m_epoch.store(epoch + 1);
+    }
+}
+
+SnapshotPublisher::Reader::Reader(SnapshotPublisher &publisher) : m_publisher(publisher)
+{
+    m_parity = m_publisher.m_epoch.load() & 1;
+    m_publisher.m_readers[m_parity]++;
+    m_snapshot = m_publisher.m_current.load();
+}
+
+SnapshotPublisher::Reader::~Reader()
+{
+    m_publisher.m_readers[m_parity]--;
+}
+
+SnapshotServer::~SnapshotServer()
+{
+    if(m_fd >= 0)
+    {
+        // Wakes the server thread up from accept()
+        m_stop = true;
+        shutdown(m_fd, SHUT_RDWR);
+        m_thread.join();
+        close(m_fd);
+        unlink(m_path.c_str());
+    }
+}
+
+bool SnapshotServer::open(const char *path)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path))
+    {
+        std::cout << "Snapshot socket path " << path << " is too long" << std::endl;
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0)
+    {
+        std::cout << "Failed to create snapshot socket: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // A socket left behind by an earlier run would make bind() fail
+    unlink(path);
+    if(bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0)
+    {
+        std::cout << "Failed to listen on " << path << ": " << strerror(errno) << std::endl;
+        close(fd);
+        return false;
+    }
+
+    m_path = path;
+    m_fd = fd;
+    m_thread = std::thread(&SnapshotServer::run, this);
+    return true;
+}
+
+void SnapshotServer::run()
+{
+    while(!m_stop)
+    {
+        const int client = accept(m_fd, nullptr, nullptr);
+        if(client < 0)
+        {
+            if(errno != EINTR && !m_stop)
+            {
+                std::cout << "Snapshot socket failed: " << strerror(errno) << std::endl;
+                break;
+            }
+            continue;
+        }
+
+        //
+        // Only hold on to the snapshot while turning it into JSON, so a slow client can't keep old
+        // ones from being freed
+        //
+        std::string json;
+        {
+            SnapshotPublisher::Reader reader(m_publisher);
+            const DeviceSnapshot empty;
+            json = (reader.get() ? reader.get() : &empty)->toJson(time(nullptr));
+        }
+
+        const timeval timeout = {SNAPSHOT_SEND_TIMEOUT_SEC, 0};
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        size_t sent = 0;
+        while(sent < json.size())
+        {
+            const ssize_t len = send(client, json.data() + sent, json.size() - sent, MSG_NOSIGNAL);
+            if(len <= 0)
+            {
+                break;
+            }
+            sent += len;
+        }
+        close(client);
+    }
+}
@@ -0,0 +1,115 @@
+#ifndef __DEVICE_SNAPSHOT_H__
+#define __DEVICE_SNAPSHOT_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <vector>
+
+//
+// The state of every sensor and keypad at one point in time.  Never changed once published.
+//
+struct DeviceSnapshot
+{
+    struct Sensor
+    {
+        uint32_t serial;
+        uint32_t lastUpdateTime;
+        bool hasLostSupervision;
+        bool loop1;
+        bool loop2;
+        bool loop3;
+        bool tamper;
+        bool lowBat;
+    };
+
+    struct Keypad
+    {
+        uint32_t serial;
+        uint32_t lastUpdateTime;
+        bool hasLostSupervision;
+        bool lowBat;
+    };
+
+    uint64_t generation = 0;
+    uint32_t createdTime = 0;
+
+    // Devices not heard from for this long count as having lost supervision
+    uint32_t supervisionTimeoutSec = 0;
+
+    std::vector<Sensor> sensors;
+    std::vector<Keypad> keypads;
+
+    // Supervision is judged against now rather than when the snapshot was taken
+    std::string toJson(time_t now) const;
+};
+
+//
+// Hands the latest snapshot from the decoding thread to any number of readers without either side
+// waiting on the other.
+//
+// The decoder swaps in a new snapshot with a single atomic exchange.  Readers count themselves in one
+// of two counters, picked by the parity of an epoch, before loading the pointer.  Each publish that
+// finds no readers left under the previous epoch's parity frees what was retired before the last
+// epoch change, since anyone who could still hold one of those counted under that parity, and moves
+// on to the next epoch.  New readers always count under the current parity, so a steady stream of
+// them can't hold old snapshots up for longer than one query.
+//
+class SnapshotPublisher
+{
+  public:
+    ~SnapshotPublisher();
+
+    // From the decoding thread only; takes ownership
+    void publish(const DeviceSnapshot *snapshot);
+
+    // Keeps the latest snapshot alive for as long as it exists; get() is null until the first publish
+    class Reader
+    {
+      public:
+        Reader(SnapshotPublisher &publisher);
+        ~Reader();
+
+        const DeviceSnapshot *get() const {return m_snapshot;};
+
+      private:
+        SnapshotPublisher &m_publisher;
+        uint32_t m_parity;
+        const DeviceSnapshot *m_snapshot;
+    };
+
+  private:
+    std::atomic<const DeviceSnapshot *> m_current{nullptr};
+    std::atomic<uint32_t> m_epoch{0};
+    std::atomic<uint32_t> m_readers[2] = {{0}, {0}};
+
+    // Replaced snapshots, since and before the last epoch change; only touched by the decoding thread
+    std::vector<const DeviceSnapshot *> m_retired;
+    std::vector<const DeviceSnapshot *> m_expiring;
+};
+
+//
+// Serves the latest snapshot as JSON on a UNIX domain socket: every client that connects gets one
+// document and is disconnected, e.g. with "socat - UNIX-CONNECT:<path>"
+//
+class SnapshotServer
+{
+  public:
+    SnapshotServer(SnapshotPublisher &publisher) : m_publisher(publisher) {};
+    ~SnapshotServer();
+
+    bool open(const char *path);
+
+  private:
+    void run();
+
+    SnapshotPublisher &m_publisher;
+    std::string m_path;
+    int m_fd = -1;
+    std::atomic<bool> m_stop{false};
+    std::thread m_thread;
+};
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef __DEVICE_TABLE_H__
+#define __DEVICE_TABLE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#define DEVICE_TABLE_EMPTY      0xFFFFFFFFu  // Not a 20 bit serial
+#define DEVICE_TABLE_MIN_BITS   6            // 64 slots to start with
+
+//
+// Per-device state keyed by the 20 bit serial, in one flat array with open addressing and linear
+// probing.  Devices are never removed, so there are no tombstones, and a lookup that misses stops at
+// the first empty slot.  The table doubles before it gets more than half full.
+//
+template<typename State>
+class DeviceTable
+{
+  public:
+    DeviceTable() : m_slots(1 << DEVICE_TABLE_MIN_BITS), m_shift(32 - DEVICE_TABLE_MIN_BITS) {}
+
+    State *find(uint32_t serial)
+    {
+        Slot &slot = probe(serial);
+        return (slot.serial == serial) ? &slot.state : nullptr;
+    }
+
+    // Finds the device's state, or adds a zeroed one, with a single probe either way.  The reference
+    // is good until the next insert.
+    State &insert(uint32_t serial, bool &inserted)
+    {
+        Slot *slot = &probe(serial);
+        inserted = (slot->serial != serial);
+        if(inserted)
+        {
+            if(2*(m_size + 1) > m_slots.size())
+            {
+                grow();
+                slot = &probe(serial);
+            }
+            slot->serial = serial;
+            slot->state = State();
+            m_size++;
+        }
+        return slot->state;
+    }
+
+    // Makes room for count devices, so that adding them won't allocate
+    void reserve(size_t count)
+    {
+        while(2*count > m_slots.size())
+        {
+            grow();
+        }
+    }
+
+    // Calls f(serial, state) for every device
+    template<typename F>
+    void forEach(F f)
+    {
+        for(Slot &slot : m_slots)
+        {
+            if(slot.serial != DEVICE_TABLE_EMPTY)
+            {
+                f(slot.serial, slot.state);
+            }
+        }
+    }
+
+    size_t size() const {return m_size;};
+    size_t memoryUsage() const {return m_slots.capacity()*sizeof(Slot);};
+
+  private:
+    struct Slot
+    {
+        uint32_t serial = DEVICE_TABLE_EMPTY;
+        State state;
+    };
+
+    // The slot holding the serial, or the empty one where it would go
+    Slot &probe(uint32_t serial)
+    {
+        // Fibonacci hashing: the top bits of the product depend on every bit of the serial
+        const size_t mask = m_slots.size() - 1;
+        size_t ii = (uint32_t)(serial*0x9E3779B1u) >> m_shift;
+        while(m_slots[ii].serial != serial && m_slots[ii].serial != DEVICE_TABLE_EMPTY)
+        {
+            ii = (ii + 1) & mask;
+        }
+        return m_slots[ii];
+    }
+
+    void grow()
+    {
+        std::vector<Slot> old(2*m_slots.size());
+        old.swap(m_slots);
+        m_shift--;
+        for(const Slot &slot : old)
+        {
+            if(slot.serial != DEVICE_TABLE_EMPTY)
+            {
+                probe(slot.serial) = slot;
+            }
+        }
+    }
+
+    std::vector<Slot> m_slots;
+    unsigned int m_shift;
+    size_t m_size = 0;
+};
+
+#endif
@@ -1,6 +1,5 @@
 #include "digitalDecoder.h"
-#include "mqtt.h"
-#include "mqtt_config.h"
+#include "config.h"
 
 #include <iostream>
 #include <fstream>
@@ -12,6 +11,9 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <csignal>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
 
 
 // Pulse checks seem to be about 60-70 minutes apart
@@ -20,30 +22,79 @@
 // Give each sensor 3 intervals before we flag a problem
 #define SENSOR_TIMEOUT_MIN  (90*5)
 
+// Over MQTT 5, a supervision refresh is dropped by the broker once the sensor would count as lost
+#define SUPERVISION_EXPIRY_SEC (SENSOR_TIMEOUT_MIN*60)
+
 #define SYNC_MASK    0xFFFF000000000000ul
 #define SYNC_PATTERN 0xFFFE000000000000ul
 
+// Number of preamble bits that may be wrong before we stop looking for a frame.  Frames found with
+// a damaged preamble are only accepted if their CRC checks out, since noise alone matches that often.
+#ifndef SYNC_MAX_BIT_ERRORS
+#define SYNC_MAX_BIT_ERRORS (2)
+#endif
+
+// Print the sync counters every this many frames
+#define SYNC_STATS_INTERVAL (100)
+
+// Number of least confident bits a Chase search flips when trying to repair a frame that failed CRC
+#ifndef CHASE_BITS
+#define CHASE_BITS (4)
+#endif
+
+// Each candidate tried against a garbage frame passes one of the two CRCs with probability 2/2^16.
+// The syndrome lookup covers the 48 single-bit patterns, and the Chase search tries 2^CHASE_BITS-1 more.
+#define REPAIR_FALSE_BOUND ((2.0*(48 + (1 << CHASE_BITS) - 1))/65536.0)
+
 // Don't send these messages more than once per minute unless there is a state change
 #define RX_GOOD_MIN_SEC (60)
 #define UPDATE_MIN_SEC (60)
 
-#define BASE_TOPIC "security/sensors345/"
-#define SENSOR_TOPIC BASE_TOPIC"sensor/"
-#define KEYFOB_TOPIC BASE_TOPIC"keyfob/"
-#define KEYPAD_TOPIC BASE_TOPIC"keypad/"
+// Publish a device's signal level at most every 10 minutes, unless it moved by 6dB or more
+#define RSSI_MIN_SEC (10*60)
+#define RSSI_CHANGE_DB (6)
+
+// Refresh the snapshot this many bit times after the first change it misses, so that the repeats of a
+// transmission cost a single copy of the tables
+#define SNAPSHOT_HOLDOFF_BITS (512)
+
+#define RSSI_HISTOGRAM_MIN_DBFS (-48)
+#define RSSI_HISTOGRAM_BIN_DB (6)
+
+// Manchester chips per second; 8 samples each at the analog decoder's output rate
+#define CHIP_RATE (1000000.0f/17/8)
+
+// Relative to the configured base topic
+#define SENSOR_TOPIC "sensor/"
+#define KEYFOB_TOPIC "keyfob/"
+#define KEYPAD_TOPIC "keypad/"
+
+DigitalDecoder::DigitalDecoder(EventSink &sink_init, std::shared_ptr<const Config> config_init) : sink(sink_init), config(config_init)
+{
+    setSampleRate(8*CHIP_RATE);
+}
+
+void DigitalDecoder::setSampleRate(float rate)
+{
+    samplesPerChip = rate/CHIP_RATE;
+    syncFlushSamples = std::lround(samplesPerChip*(SYNC_MAX_BIT_ERRORS + 2));
+    snapshotHoldoffSamples = std::lround(samplesPerChip*SNAPSHOT_HOLDOFF_BITS);
+}
+
+void DigitalDecoder::setConfig(std::shared_ptr<const Config> newConfig)
+{
+    std::atomic_store(&config, newConfig);
+}
 
 void DigitalDecoder::setRxGood(bool state)
 {
-    std::string topic(BASE_TOPIC);
     timeval now;
 
-    topic += "rx_status";
-
     gettimeofday(&now, nullptr);
 
     if (rxGood != state || (now.tv_sec - lastRxGoodUpdateTime) > RX_GOOD_MIN_SEC)
     {
-        mqtt.send(topic.c_str(), state ? "OK" : "FAILED");
+        sink.send(Event("", "rx_status", state ? "OK" : "FAILED"));
     }
 
     // Reset watchdog either way
@@ -60,8 +111,8 @@ void DigitalDecoder::updateKeyfobState(uint32_t serial, uint64_t payload)
         return;
     }
 
-    std::ostringstream topic;
-    topic << KEYFOB_TOPIC << serial << "/keypress";
+    std::ostringstream device;
+    device << KEYFOB_TOPIC << serial;
     char c = ((payload & 0x000000F00000) >> 20);
     std::string key;
     if (c == 0x1)
@@ -84,7 +135,7 @@ void DigitalDecoder::updateKeyfobState(uint32_t serial, uint64_t payload)
     {
         key = "UNK";
     }
-    mqtt.send(topic.str().c_str(), key.c_str(), 1, false);
+    sink.send(Event(device.str(), "keypress", key, 1, false));
 
     lastKeyfobPayload = payload;
 }
@@ -94,8 +145,8 @@ void DigitalDecoder::updateKeypadState(uint32_t serial, uint64_t payload)
     timeval now;
     gettimeofday(&now, nullptr);
 
-    struct keypadState_t lastState;
-    struct keypadState_t currentState;
+    struct keypadState_t lastState = {};
+    struct keypadState_t currentState = {};
 
     currentState.lastUpdateTime = now.tv_sec;
     currentState.hasLostSupervision = false;
@@ -106,21 +157,22 @@ void DigitalDecoder::updateKeypadState(uint32_t serial, uint64_t payload)
     bool supervised = payload & 0x000000040000;
     if (supervised) return;
 
-    auto found = keypadStatusMap.find(serial);
-    if (found == keypadStatusMap.end())
+    bool inserted;
+    keypadState_t &state = keypadStatusMap.insert(serial, inserted);
+    if (inserted)
     {
         lastState.sequence = 0xff;
         lastState.lowBat = !currentState.lowBat;
     }
     else
     {
-        lastState = found->second;
+        lastState = state;
     }
 
     if (currentState.sequence != lastState.sequence)
     {
-        std::ostringstream topic;
-        topic << KEYPAD_TOPIC << serial << "/keypress";
+        std::ostringstream device;
+        device << KEYPAD_TOPIC << serial;
         char c = ((payload & 0x000000F00000) >> 20);
         
         std::string key;
@@ -156,32 +208,33 @@ void DigitalDecoder::updateKeypadState(uint32_t serial, uint64_t payload)
         {
             key = (c + '0');
         }
-        mqtt.send(topic.str().c_str(), key.c_str(), 1, false);
+        sink.send(Event(device.str(), "keypress", key, 1, false));
         
-        if ((c >= 1 && c <= 0xC) && (currentState.lastUpdateTime <= (lastState.lastUpdateTime + 2)) && (lastState.phrase.length() < 10))
+        if ((c >= 1 && c <= 0xC) && (currentState.lastUpdateTime <= (lastState.lastUpdateTime + 2)) && (lastState.phraseLength < 10))
         {
-            currentState.phrase = lastState.phrase + key;
+            memcpy(currentState.phrase, lastState.phrase, lastState.phraseLength);
+            currentState.phrase[lastState.phraseLength] = key[0];
+            currentState.phraseLength = lastState.phraseLength + 1;
             
-            std::ostringstream phraseTopic;
-            phraseTopic << KEYPAD_TOPIC << serial << "/keyphrase/" << currentState.phrase.length();
-            mqtt.send(phraseTopic.str().c_str(), currentState.phrase.c_str(), 1, false);
+            sink.send(Event(device.str(), "keyphrase/" + std::to_string(currentState.phraseLength), currentState.phrase, 1, false));
         }
         else if (c == 0xB || (c >= 1 && c <= 9))
         {
-            currentState.phrase = key;
+            currentState.phrase[0] = key[0];
+            currentState.phraseLength = 1;
         }
         
-        keypadStatusMap[serial] = currentState;
+        state = currentState;
     }
 }
 
-void DigitalDecoder::updateSensorState(uint32_t serial, uint64_t payload)
+void DigitalDecoder::updateSensorState(uint32_t serial, uint64_t payload, const frameSignal_t &signal)
 {
     timeval now;
     gettimeofday(&now, nullptr);
 
-    struct sensorState_t lastState;
-    struct sensorState_t currentState;
+    struct sensorState_t lastState = {};
+    struct sensorState_t currentState = {};
 
     currentState.lastUpdateTime = now.tv_sec;
     currentState.hasLostSupervision = false;
@@ -197,8 +250,9 @@ void DigitalDecoder::updateSensorState(uint32_t serial, uint64_t payload)
 
     //std::cout << "Payload:" << std::hex << payload << " Serial:" << std::dec << serial << std::boolalpha << " Loop1:" << currentState.loop1 << std::endl;
 
-    auto found = sensorStatusMap.find(serial);
-    if (found == sensorStatusMap.end())
+    bool inserted;
+    sensorState_t &state = sensorStatusMap.insert(serial, inserted);
+    if (inserted)
     {
         // if there wasn't a state, make up a state that is opposite to our current state
         // so that we send everything.
@@ -213,49 +267,62 @@ void DigitalDecoder::updateSensorState(uint32_t serial, uint64_t payload)
     }
     else
     {
-        lastState = found->second;
+        lastState = state;
     }
     
+    auto config = std::atomic_load(&this->config);
+    const std::string device = SENSOR_TOPIC + std::to_string(serial);
+
     // Since the sensor will frequently blast out the same signal many times, we only want to treat
     // the first detected signal as the supervisory signal. 
     bool supervised = (payload & 0x000000040000) && ((currentState.lastUpdateTime - lastState.lastUpdateTime) > 2);
 
+    //
+    // If asked for, the first field sent for a frame says when it was heard and how strongly; the
+    // others would only repeat that
+    //
+    char rssi[16];
+    snprintf(rssi, sizeof(rssi), "%.1f", signal.meanDbfs);
+    bool first = config->mqtt5Properties;
+    auto send = [&](const char *field, const std::string &value)
+    {
+        Event event(device, field, value, supervised ? 0 : 1);
+        event.expirySec = (supervised && config->mqtt5Expiry) ? SUPERVISION_EXPIRY_SEC : 0;
+        if(first)
+        {
+            event.properties.emplace_back("rssi", rssi);
+            event.properties.emplace_back("timestamp_us", std::to_string(event.timestampUs));
+            first = false;
+        }
+        sink.send(event);
+    };
+
     if ((currentState.loop1 != lastState.loop1) || supervised)
     {
-        std::ostringstream topic;
-        topic << SENSOR_TOPIC << serial << "/loop1";
-        mqtt.send(topic.str().c_str(), currentState.loop1 ? OPEN_SENSOR_MSG : CLOSED_SENSOR_MSG, supervised ? 0 : 1);
+        send("loop1", currentState.loop1 ? config->openSensorMsg : config->closedSensorMsg);
     }
 
     if ((currentState.loop2 != lastState.loop2) || supervised)
     {
-        std::ostringstream topic;
-        topic << SENSOR_TOPIC << serial << "/loop2";
-        mqtt.send(topic.str().c_str(), currentState.loop2 ? OPEN_SENSOR_MSG : CLOSED_SENSOR_MSG, supervised ? 0 : 1);
+        send("loop2", currentState.loop2 ? config->openSensorMsg : config->closedSensorMsg);
     }
 
     if ((currentState.loop3 != lastState.loop3) || supervised)
     {
-        std::ostringstream topic;
-        topic << SENSOR_TOPIC << serial << "/loop3";
-        mqtt.send(topic.str().c_str(), currentState.loop3 ? OPEN_SENSOR_MSG : CLOSED_SENSOR_MSG, supervised ? 0 : 1);
+        send("loop3", currentState.loop3 ? config->openSensorMsg : config->closedSensorMsg);
     }
 
     if ((currentState.tamper != lastState.tamper) || supervised)
     {
-        std::ostringstream topic;
-        topic << SENSOR_TOPIC << serial << "/tamper";
-        mqtt.send(topic.str().c_str(), currentState.tamper ? TAMPER_MSG : UNTAMPERED_MSG, supervised ? 0 : 1);
+        send("tamper", currentState.tamper ? config->tamperMsg : config->untamperedMsg);
     }
 
     if ((currentState.lowBat != lastState.lowBat) || supervised)
     {
-        std::ostringstream topic;
-        topic << SENSOR_TOPIC << serial << "/battery";
-        mqtt.send(topic.str().c_str(), currentState.lowBat ? LOW_BAT_MSG : OK_BAT_MSG, supervised ? 0 : 1);
+        send("battery", currentState.lowBat ? config->lowBatMsg : config->okBatMsg);
     }
 
-    sensorStatusMap[serial] = currentState;
+    state = currentState;
 }
 
 /* Checks all devices for last time updated */
@@ -267,19 +334,98 @@ void DigitalDecoder::checkForTimeouts()
     status << "TIMEOUT";
     gettimeofday(&now, nullptr);
 
-    for(const auto &dd : sensorStatusMap)
+    sensorStatusMap.forEach([&](uint32_t serial, sensorState_t &state)
     {
-        if ((now.tv_sec - dd.second.lastUpdateTime) > SENSOR_TIMEOUT_MIN*60)
+        if ((now.tv_sec - state.lastUpdateTime) > SENSOR_TIMEOUT_MIN*60)
         {
-            if (false == dd.second.hasLostSupervision)
+            if (false == state.hasLostSupervision)
             {
-                std::ostringstream statusTopic;
-
-                sensorStatusMap[dd.first].hasLostSupervision = true;
-                statusTopic << BASE_TOPIC << dd.first << "/status";
-                mqtt.send(statusTopic.str().c_str(), status.str().c_str());
+                state.hasLostSupervision = true;
+                sink.send(Event(std::to_string(serial), "status", status.str()));
             }
         }
+    });
+}
+
+void DigitalDecoder::markSnapshotDirty()
+{
+    if(snapshotPublisher && !snapshotDirty)
+    {
+        snapshotDirty = true;
+        snapshotDirtySamples = 0;
+    }
+}
+
+void DigitalDecoder::flushSnapshot()
+{
+    if(snapshotDirty)
+    {
+        publishSnapshot();
+    }
+}
+
+/* Copies the device tables into a new snapshot for other threads to read */
+void DigitalDecoder::publishSnapshot()
+{
+    snapshotDirty = false;
+
+    timeval now;
+    gettimeofday(&now, nullptr);
+
+    DeviceSnapshot *snapshot = new DeviceSnapshot();
+    snapshot->generation = ++snapshotGeneration;
+    snapshot->createdTime = now.tv_sec;
+    snapshot->supervisionTimeoutSec = SENSOR_TIMEOUT_MIN*60;
+
+    snapshot->sensors.reserve(sensorStatusMap.size());
+    sensorStatusMap.forEach([&](uint32_t serial, sensorState_t &state)
+    {
+        snapshot->sensors.push_back({serial, state.lastUpdateTime, state.hasLostSupervision,
+            state.loop1, state.loop2, state.loop3, state.tamper, state.lowBat});
+    });
+
+    snapshot->keypads.reserve(keypadStatusMap.size());
+    keypadStatusMap.forEach([&](uint32_t serial, keypadState_t &state)
+    {
+        snapshot->keypads.push_back({serial, state.lastUpdateTime, state.hasLostSupervision, state.lowBat});
+    });
+
+    snapshotPublisher->publish(snapshot);
+}
+
+/* Saves the raw IQ around frames worth a closer look */
+void DigitalDecoder::checkCaptureTriggers(uint64_t payload, bool valid, bool sensorPacket)
+{
+    const uint64_t sof = (payload & 0xF00000000000) >> 44;
+    const uint32_t ser = (payload & 0x0FFFFF000000) >> 24;
+
+    if(!valid)
+    {
+        // The oldest of the last few failures is the one the new one overwrites next
+        const time_t now = time(nullptr);
+        crcFailureTimes[crcFailureIndex] = now;
+        crcFailureIndex = (crcFailureIndex + 1) % CAPTURE_CRC_BURST;
+
+        if(crcFailureTimes[crcFailureIndex] != 0 && (now - crcFailureTimes[crcFailureIndex]) <= CAPTURE_CRC_BURST_SEC)
+        {
+            iqRing->trigger("crc-burst");
+        }
+        return;
+    }
+
+    // The brands isPayloadValid() knows by their start of frame
+    const bool knownBrand = (sof == 0x2 || sof == 0x3 || sof == 0x4 || sof == 0x7 || sof == 0x8 || sof == 0x9
+        || sof == 0xA || sof == 0xB || sof == 0xC || sof == 0xD || sof == 0xE || sof == 0xF);
+    if(sensorPacket && !knownBrand)
+    {
+        iqRing->trigger("unknown-brand-" + std::to_string(sof));
+        return;
+    }
+
+    auto config = std::atomic_load(&this->config);
+    if(std::find(config->captureSerials.begin(), config->captureSerials.end(), ser) != config->captureSerials.end())
+    {
+        iqRing->trigger("serial-" + std::to_string(ser));
     }
 }
 
@@ -334,10 +480,15 @@ bool DigitalDecoder::isPayloadValid(uint64_t payload, uint64_t polynomial) const
         }
         printf(" - ");
     }
+    return (crcRemainder(payload, polynomial) == 0);
+}
+
+uint64_t DigitalDecoder::crcRemainder(uint64_t payload, uint64_t polynomial)
+{
     uint64_t sum = payload & (~SYNC_MASK);
     uint64_t current_divisor = polynomial << 31;
 
-    while(current_divisor >= polynomial)
+    while(current_divisor >= polynomial && sum != 0)
     {
         #ifdef __arm__
         if(__builtin_clzll(sum) == __builtin_clzll(current_divisor))
@@ -350,11 +501,213 @@ bool DigitalDecoder::isPayloadValid(uint64_t payload, uint64_t polynomial) const
         current_divisor >>= 1;
     }
 
-    return (sum == 0);
+    return sum;
+}
+
+/* Same checks as handlePayload, without the logging */
+bool DigitalDecoder::isFrameValid(uint64_t payload) const
+{
+    uint64_t sof = (payload & 0xF00000000000) >> 44;
+    uint64_t typ = (payload & 0x000000FF0000) >> 16;
+
+    if (isPayloadValid(payload, (sof == 0x8) ? 0x18005 : 0x18050))
+    {
+        return true;
+    }
+    return (typ & 0x03) && isPayloadValid(payload, 0x18050);
+}
+
+// CRC syndrome -> 1 + position of the single flipped bit that causes it, 0 if none or ambiguous
+struct DigitalDecoder::SyndromeTable
+{
+    uint64_t polynomial;
+    uint8_t position[0x10000];
+
+    SyndromeTable(uint64_t poly) : polynomial(poly)
+    {
+        memset(position, 0, sizeof(position));
+        for(int bit = 0; bit < 48; ++bit)
+        {
+            uint64_t syndrome = crcRemainder(1ull << bit, polynomial);
+            position[syndrome] = (position[syndrome] == 0) ? (bit + 1) : 0xFF;
+        }
+    }
+};
+
+/* One table per CRC polynomial, built the first time a frame needs repairing unless prefault() did it */
+const DigitalDecoder::SyndromeTable *DigitalDecoder::syndromeTables()
+{
+    static const SyndromeTable tables[SYNDROME_TABLES] = {SyndromeTable(0x18005), SyndromeTable(0x18050)};
+    return tables;
+}
+
+void DigitalDecoder::prefault(size_t deviceCount)
+{
+    syndromeTables();
+    sensorStatusMap.reserve(deviceCount);
+    keypadStatusMap.reserve(deviceCount);
+    linkStatusMap.reserve(deviceCount);
+}
+
+/* Tries to turn a frame that failed CRC into one that passes.  Single bit errors are looked up by
+   syndrome; failing that, every combination of the CHASE_BITS least confident bits is flipped and
+   the cheapest valid one, by the confidence given up, is kept. */
+bool DigitalDecoder::repairPayload(uint64_t payload, uint64_t &repaired)
+{
+    repairAttemptCount++;
+
+    const SyndromeTable *tables = syndromeTables();
+    for(int ii = 0; ii < SYNDROME_TABLES; ++ii)
+    {
+        const SyndromeTable &table = tables[ii];
+        uint8_t position = table.position[crcRemainder(payload, table.polynomial)];
+        if(position != 0 && position != 0xFF)
+        {
+            uint64_t candidate = payload ^ (1ull << (position - 1));
+            if(isFrameValid(candidate))
+            {
+                repaired = candidate;
+                repairedCount++;
+                return true;
+            }
+        }
+    }
+
+    // Find the least confident bits
+    int weakest[CHASE_BITS];
+    bool used[48] = {};
+    for(int ii = 0; ii < CHASE_BITS; ++ii)
+    {
+        weakest[ii] = -1;
+        for(int bit = 0; bit < 48; ++bit)
+        {
+            if(!used[bit] && (weakest[ii] < 0 || frameBits[bit].confidence < frameBits[weakest[ii]].confidence))
+            {
+                weakest[ii] = bit;
+            }
+        }
+        used[weakest[ii]] = true;
+    }
+
+    bool found = false;
+    float bestCost = 0.0f;
+    for(unsigned int pattern = 1; pattern < (1u << CHASE_BITS); ++pattern)
+    {
+        uint64_t candidate = payload;
+        float cost = 0.0f;
+        for(int ii = 0; ii < CHASE_BITS; ++ii)
+        {
+            if(pattern & (1u << ii))
+            {
+                candidate ^= (1ull << weakest[ii]);
+                cost += frameBits[weakest[ii]].confidence;
+            }
+        }
+
+        if((!found || cost < bestCost) && isFrameValid(candidate))
+        {
+            found = true;
+            bestCost = cost;
+            repaired = candidate;
+        }
+    }
+
+    if(found)
+    {
+        repairedCount++;
+    }
+    return found;
+}
+
+/* Peak and mean of the current frame's high chips, and the mean of its low chips as the noise floor */
+DigitalDecoder::frameSignal_t DigitalDecoder::measureFrameSignal() const
+{
+    float peak = 0.0f;
+    float highSum = 0.0f;
+    float lowSum = 0.0f;
+    for(const auto &bit : frameBits)
+    {
+        peak = std::max(peak, bit.highLevel);
+        highSum += bit.highLevel;
+        lowSum += bit.lowLevel;
+    }
+
+    frameSignal_t signal;
+    signal.peakDbfs = 20.0f*std::log10(std::max(peak, 1e-6f));
+    signal.meanDbfs = 20.0f*std::log10(std::max(highSum/48, 1e-6f));
+    signal.noiseDbfs = 20.0f*std::log10(std::max(lowSum/48, 1e-6f));
+    return signal;
+}
+
+void DigitalDecoder::updateLinkState(const char *deviceType, uint32_t serial, const frameSignal_t &signal)
+{
+    bool inserted;
+    linkState_t &link = linkStatusMap.insert(serial, inserted);
+
+    //
+    // Once a bin fills up, halve them all so the histogram follows recent frames
+    //
+    const int bin = std::min(std::max((int)((signal.meanDbfs - RSSI_HISTOGRAM_MIN_DBFS)/RSSI_HISTOGRAM_BIN_DB), 0), RSSI_HISTOGRAM_BINS - 1);
+    if(link.histogram[bin] == 0xFF)
+    {
+        for(auto &count : link.histogram)
+        {
+            count /= 2;
+        }
+    }
+    link.histogram[bin]++;
+
+    timeval now;
+    gettimeofday(&now, nullptr);
+
+    const int rssi = std::lround(signal.meanDbfs);
+    if(!inserted && (now.tv_sec - link.lastPublishTime) < RSSI_MIN_SEC && std::abs(rssi - link.lastPublishedRssi) < RSSI_CHANGE_DB)
+    {
+        return;
+    }
+
+    link.lastPublishTime = now.tv_sec;
+    link.lastPublishedRssi = rssi;
+
+    const std::string device = deviceType + std::to_string(serial);
+    char value[64];
+
+    snprintf(value, sizeof(value), "%.1f", signal.meanDbfs);
+    sink.send(Event(device, "rssi", value, 0, true));
+    snprintf(value, sizeof(value), "%.1f", signal.meanDbfs - signal.noiseDbfs);
+    sink.send(Event(device, "snr", value, 0, true));
+
+    std::string histogram;
+    for(int ii = 0; ii < RSSI_HISTOGRAM_BINS; ++ii)
+    {
+        histogram += (ii ? "," : "") + std::to_string(link.histogram[ii]);
+    }
+    sink.send(Event(device, "rssi_histogram", histogram, 0, true));
 }
 
 void DigitalDecoder::handlePayload(uint64_t payload)
 {
+    uint64_t repaired;
+    bool wasRepaired = false;
+    if(!isFrameValid(payload))
+    {
+        if(repairPayload(payload, repaired))
+        {
+            wasRepaired = true;
+ #ifdef __arm__
+            printf("Repaired Payload: %llX -> %llX\n", payload, repaired);
+ #else
+            printf("Repaired Payload: %lX -> %lX\n", payload, repaired);
+ #endif
+            payload = repaired;
+        }
+
+        if((repairAttemptCount % SYNC_STATS_INTERVAL) == 0)
+        {
+            printf("%u/%u failed packets repaired, at most %.2f of them expected to be false\n", repairedCount, repairAttemptCount, repairAttemptCount*REPAIR_FALSE_BOUND);
+        }
+    }
+
     uint64_t ser = (payload & 0x0FFFFF000000) >> 24;
     uint64_t typ = (payload & 0x000000FF0000) >> 16; 
 
@@ -371,6 +724,17 @@ void DigitalDecoder::handlePayload(uint64_t payload)
     printf("%s Payload: %lX (Serial %lu/%lX, Status %lX)\n", (validSensorPacket | validKeypadPacket | validKeyfobPacket) ? "Valid" : "Invalid", payload, ser, ser, typ);
  #endif
 
+    const frameSignal_t signal = measureFrameSignal();
+    if(frameTap)
+    {
+        frameTap->write(payload, validSensorPacket || validKeypadPacket || validKeyfobPacket, wasRepaired,
+            signal.meanDbfs, signal.peakDbfs, signal.noiseDbfs);
+    }
+    if(burstArchive)
+    {
+        burstArchive->noteFrame(payload, validSensorPacket || validKeypadPacket || validKeyfobPacket, signal.meanDbfs, frameEndSample);
+    }
+
     packetCount++;
     if(!validSensorPacket && !validKeypadPacket && !validKeyfobPacket)
     {
@@ -379,54 +743,134 @@ void DigitalDecoder::handlePayload(uint64_t payload)
         std::cout << std::endl;
     }
 
+    if(iqRing)
+    {
+        checkCaptureTriggers(payload, validSensorPacket || validKeypadPacket || validKeyfobPacket,
+            validSensorPacket && !validKeypadPacket && !validKeyfobPacket);
+    }
+
+    if(autoGain && (validSensorPacket || validKeypadPacket || validKeyfobPacket))
+    {
+        autoGain->handleFrame(signal.meanDbfs, signal.peakDbfs, signal.noiseDbfs);
+    }
+
     //
     // Tell the world
     //
-    if(validSensorPacket && !validKeypadPacket && !validKeyfobPacket && keypadStatusMap.find(ser) == keypadStatusMap.end())
+    if(validSensorPacket && !validKeypadPacket && !validKeyfobPacket && !keypadStatusMap.find(ser))
     {
         printf("Sensor Packet\n");
         // We received a valid packet so the receiver must be working
         setRxGood(true);
         // Update the device
-        updateSensorState(ser, payload);
+        updateSensorState(ser, payload, signal);
+        updateLinkState(SENSOR_TOPIC, ser, signal);
+        markSnapshotDirty();
     }
     else if (validKeypadPacket)
     {
         printf("Keypad Packet\n");
         setRxGood(true);
         updateKeypadState(ser, payload);
+        updateLinkState(KEYPAD_TOPIC, ser, signal);
+        markSnapshotDirty();
     }
     else if (validKeyfobPacket)
     {
         printf("Keyfob Packet\n");
         setRxGood(true);
         updateKeyfobState(ser, payload);
+        updateLinkState(KEYFOB_TOPIC, ser, signal);
     }
 }
 
 
 
-void DigitalDecoder::handleBit(bool value)
+void DigitalDecoder::handleBit(bool value, const bitInfo_t &info)
 {
-    static uint64_t payload = 0;
+    shiftRegister <<= 1;
+    shiftRegister |= (value ? 1 : 0);
 
-    payload <<= 1;
-    payload |= (value ? 1 : 0);
+    bitHistory[bitIndex] = info;
+    bitIndex = (bitIndex + 1) % 64;
 
 //#ifdef __arm__
-//    printf("Got bit: %d, payload is now %llX\n", value?1:0, payload);
+//    printf("Got bit: %d, payload is now %llX\n", value?1:0, shiftRegister);
 //#else
-//    printf("Got bit: %d, payload is now %lX\n", value?1:0, payload);
+//    printf("Got bit: %d, payload is now %lX\n", value?1:0, shiftRegister);
 //#endif
 
-    if((payload & SYNC_MASK) == SYNC_PATTERN)
+    if(hasSyncCandidate)
+    {
+        syncCandidateAge++;
+    }
+
+    // Number of preamble bits that differ from the sync pattern
+    const int syncErrors = __builtin_popcountll((shiftRegister & SYNC_MASK) ^ SYNC_PATTERN);
+
+    if(syncErrors <= SYNC_MAX_BIT_ERRORS)
+    {
+        const uint64_t candidate = (shiftRegister & ~SYNC_MASK) | SYNC_PATTERN;
+        const bool valid = isPayloadValid(candidate, 0x18005) || isPayloadValid(candidate, 0x18050);
+
+        // A frame whose CRC ends in a zero also validates when read one bit early, so within the
+        // window the latest valid alignment wins.  Exact syncs that fail CRC are kept as well, so
+        // they are still reported (and counted) as errors if nothing better turns up.
+        if(valid || (syncErrors == 0 && !(hasSyncCandidate && syncCandidateValid)))
+        {
+            hasSyncCandidate = true;
+            syncCandidateValid = valid;
+            syncCandidateErrors = syncErrors;
+            syncCandidatePayload = candidate;
+            syncCandidateBitIndex = bitIndex;
+            syncCandidateSample = sampleCount;
+            syncCandidateAge = 0;
+        }
+        else
+        {
+            syncRejectedCount++;
+        }
+    }
+
+    if(hasSyncCandidate && syncCandidateAge > SYNC_MAX_BIT_ERRORS)
+    {
+        flushSyncCandidate();
+    }
+}
+
+void DigitalDecoder::flushSyncCandidate()
+{
+    if(!hasSyncCandidate) return;
+
+    if(syncCandidateErrors == 0)
+    {
+        syncExactCount++;
+    }
+    else
+    {
+        syncCorrectedCount++;
+    }
+
+    // Start over so the same frame isn't found again at a neighbouring alignment
+    hasSyncCandidate = false;
+    shiftRegister = 0;
+
+    for(int ii = 0; ii < 48; ++ii)
+    {
+        frameBits[ii] = bitHistory[(syncCandidateBitIndex + 63 - ii) % 64];
+    }
+    frameEndSample = syncCandidateSample;
+
+    handlePayload(syncCandidatePayload);
+
+    const uint32_t syncCount = syncExactCount + syncCorrectedCount;
+    if((syncCount % SYNC_STATS_INTERVAL) == 0)
     {
-        handlePayload(payload);
-        payload = 0;
+        printf("Sync: %u exact, %u with preamble errors, %u candidates rejected\n", syncExactCount, syncCorrectedCount, syncRejectedCount);
     }
 }
 
-void DigitalDecoder::decodeBit(bool value)
+void DigitalDecoder::decodeBit(bool value, float confidence, float level)
 {
     enum ManchesterState
     {
@@ -438,60 +882,83 @@ void DigitalDecoder::decodeBit(bool value)
 
     static ManchesterState state = LOW_PHASE_A;
 
+    // A bit is only as trustworthy as the weaker of its two chips.  One of them is high and the
+    // other low, which gives a signal and a noise level for every bit.
     switch(state)
     {
         case LOW_PHASE_A:
         {
+            pendingBit.confidence = std::min(lastChipConfidence, confidence);
+            pendingBit.highLevel = level;
+            pendingBit.lowLevel = lastChipLevel;
             state = value ? HIGH_PHASE_B : LOW_PHASE_A;
             break;
         }
         case LOW_PHASE_B:
         {
-            handleBit(false);
+            handleBit(false, pendingBit);
             state = value ? HIGH_PHASE_A : LOW_PHASE_A;
             break;
         }
         case HIGH_PHASE_A:
         {
+            pendingBit.confidence = std::min(lastChipConfidence, confidence);
+            pendingBit.highLevel = lastChipLevel;
+            pendingBit.lowLevel = level;
             state = value ? HIGH_PHASE_A : LOW_PHASE_B;
             break;
         }
         case HIGH_PHASE_B:
         {
-            handleBit(true);
+            handleBit(true, pendingBit);
             state = value ? HIGH_PHASE_A : LOW_PHASE_A;
             break;
         }
     }
+
+    lastChipConfidence = confidence;
+    lastChipLevel = level;
 }
 
-void DigitalDecoder::handleData(char data)
+void DigitalDecoder::handleData(char data, float confidence, float level)
 {
-    static const int samplesPerBit = 8;
-
-
     if(data != 0 && data != 1) return;
+    sampleCount++;
+
+    if(snapshotDirty && ++snapshotDirtySamples == snapshotHoldoffSamples)
+    {
+        publishSnapshot();
+    }
 
     const bool thisSample = (data == 1);
 
     if(thisSample == lastSample)
     {
-        samplesSinceEdge++;
-
         //if(samplesSinceEdge < 100)
         //{
         //    printf("At %d for %u\n", thisSample?1:0, samplesSinceEdge);
         //}
 
-        if((samplesSinceEdge % samplesPerBit) == (samplesPerBit/2))
+        // Chips are sampled in their middle, timed from the last edge; the samples per chip needn't
+        // be a whole number
+        samplesToChip -= 1.0f;
+        if(samplesToChip <= 0.0f)
         {
             // This Sample is a new bit
-            decodeBit(thisSample);
+            decodeBit(thisSample, confidence, level);
+            samplesToChip += samplesPerChip;
+        }
+
+        // No more bits are coming, so don't sit on a sync candidate until the next transmission
+        if(samplesSinceEdge < syncFlushSamples && ++samplesSinceEdge == syncFlushSamples)
+        {
+            flushSyncCandidate();
         }
     }
     else
     {
         samplesSinceEdge = 1;
+        samplesToChip = samplesPerChip/2 - 1.0f;
     }
     lastSample = thisSample;
 }
@@ -1,67 +1,198 @@
 #ifndef __DIGITAL_DECODER_H__
 #define __DIGITAL_DECODER_H__
 
-#include "mqtt.h"
+#include "eventSink.h"
+#include "frameTap.h"
+#include "iqRing.h"
+#include "burstArchive.h"
+#include "config.h"
+#include "deviceTable.h"
+#include "deviceSnapshot.h"
+#include "autoGain.h"
 
 #include <stdint.h>
-#include <map>
-#include <string>
+#include <memory>
+#include <ctime>
+
+// Rolling histogram of each device's frame levels: 6dB wide bins from -48dBFS up
+#define RSSI_HISTOGRAM_BINS (8)
+
+// This many CRC failures within CAPTURE_CRC_BURST_SEC trigger a capture
+#define CAPTURE_CRC_BURST (3)
+#define CAPTURE_CRC_BURST_SEC (10)
+
+// One syndrome table for each of the two CRC polynomials
+#define SYNDROME_TABLES (2)
 class DigitalDecoder
 {
   public:
-    DigitalDecoder(Mqtt &mqtt_init) : mqtt(mqtt_init) {}
+    DigitalDecoder(EventSink &sink_init, std::shared_ptr<const Config> config_init);
+
+    void handleData(char data, float confidence, float level);
+    void setFrameTap(FrameTap *tap) {frameTap = tap;}
+    void setIqRing(IqRing *ring) {iqRing = ring;}
+    void setSnapshotPublisher(SnapshotPublisher *publisher) {snapshotPublisher = publisher;}
+    void setAutoGain(AutoGain *gain) {autoGain = gain;}
+    void setBurstArchive(BurstArchive *archive) {burstArchive = archive;}
 
-    void handleData(char data);
+    // Rate of the samples given to handleData(); 8 samples per chip until set
+    void setSampleRate(float rate);
+
+    // Builds the lookup tables and makes room for this many devices up front, so that none of it
+    // happens while receiving
+    void prefault(size_t deviceCount);
+
+    // Publishes a snapshot right away if the tables changed since the last one, rather than after the
+    // usual holdoff; from the decoding thread, or once it has stopped
+    void flushSnapshot();
+
+    // Payloads; may be called from any thread
+    void setConfig(std::shared_ptr<const Config> newConfig);
     void setRxGood(bool state);
 
 protected:
     bool isPayloadValid(uint64_t payload, uint64_t polynomial=0) const;
+    bool isFrameValid(uint64_t payload) const;
+    bool repairPayload(uint64_t payload, uint64_t &repaired);
+    static uint64_t crcRemainder(uint64_t payload, uint64_t polynomial);
+
+    struct SyndromeTable;
+    static const SyndromeTable *syndromeTables();
 
   private:
 
+    // Levels of a frame's high and low chips, relative to full scale
+    struct frameSignal_t
+    {
+        float peakDbfs;
+        float meanDbfs;
+        float noiseDbfs;
+    };
+
     void writeDeviceState();
     void sendDeviceState();
-    void updateSensorState(uint32_t serial, uint64_t payload);
+    void updateSensorState(uint32_t serial, uint64_t payload, const frameSignal_t &signal);
     void updateKeypadState(uint32_t serial, uint64_t payload);
     void updateKeyfobState(uint32_t serial, uint64_t payload);
     void handlePayload(uint64_t payload);
-    void handleBit(bool value);
-    void decodeBit(bool value);
+
+    void updateLinkState(const char *deviceType, uint32_t serial, const frameSignal_t &signal);
+    struct bitInfo_t
+    {
+        float confidence;
+        float highLevel;
+        float lowLevel;
+    };
+
+    void handleBit(bool value, const bitInfo_t &info);
+    void flushSyncCandidate();
+    void decodeBit(bool value, float confidence, float level);
+    frameSignal_t measureFrameSignal() const;
     void checkForTimeouts();
+    void checkCaptureTriggers(uint64_t payload, bool valid, bool sensorPacket);
+    void markSnapshotDirty();
+    void publishSnapshot();
 
+    float samplesPerChip;
+    unsigned int syncFlushSamples;
+    unsigned int snapshotHoldoffSamples;
+
+    // Stops counting at syncFlushSamples, since nothing after that depends on it
     unsigned int samplesSinceEdge = 0;
+
+    // Samples handled since startup; frames are placed in the IQ by the sample their sync was found at
+    uint64_t sampleCount = 0;
+    // Samples until the middle of the next chip; kept small, so that it stays exact however long a
+    // level lasts
+    float samplesToChip = 0.0f;
     bool lastSample = false;
     bool rxGood = false;
     uint64_t lastRxGoodUpdateTime = 0;
-    Mqtt &mqtt;
+    EventSink &sink;
+    std::shared_ptr<const Config> config;
     uint32_t packetCount = 0;
     uint32_t errorCount = 0;
+    uint32_t syncExactCount = 0;
+    uint32_t syncCorrectedCount = 0;
+    uint32_t syncRejectedCount = 0;
+    uint32_t repairAttemptCount = 0;
+    uint32_t repairedCount = 0;
+
+    uint64_t shiftRegister = 0;
+    bool hasSyncCandidate = false;
+    bool syncCandidateValid = false;
+    int syncCandidateErrors = 0;
+    int syncCandidateAge = 0;
+    uint64_t syncCandidatePayload = 0;
+    unsigned int syncCandidateBitIndex = 0;
+    uint64_t syncCandidateSample = 0;
+
+    // Confidence and chip levels of the most recent bits, and of each payload bit (LSB first) of
+    // the current frame
+    float lastChipConfidence = 0.0f;
+    float lastChipLevel = 0.0f;
+    bitInfo_t pendingBit = {};
+    bitInfo_t bitHistory[64] = {};
+    unsigned int bitIndex = 0;
+    bitInfo_t frameBits[48] = {};
+    uint64_t frameEndSample = 0;
+
+    FrameTap *frameTap = nullptr;
+
+    // Every frame is filed with the burst it came in
+    BurstArchive *burstArchive = nullptr;
+
+    // Told how strong every valid frame was, to pick the tuner gain by
+    AutoGain *autoGain = nullptr;
 
+    // Raw IQ is saved on a burst of CRC failures, an unknown brand, or a watched serial
+    IqRing *iqRing = nullptr;
+    time_t crcFailureTimes[CAPTURE_CRC_BURST] = {};
+    unsigned int crcFailureIndex = 0;
+
+    // A copy of the device tables for queries from other threads, replaced whenever they change
+    SnapshotPublisher *snapshotPublisher = nullptr;
+    uint64_t snapshotGeneration = 0;
+    bool snapshotDirty = false;
+    unsigned int snapshotDirtySamples = 0;
+
+    // Packed so that a sensor takes 12 bytes of table and a keypad 24
     struct sensorState_t
     {
-        uint64_t lastUpdateTime;
-        bool hasLostSupervision;
-
-        bool loop1;
-        bool loop2;
-        bool loop3;
-        bool tamper;
-        bool lowBat;
+        uint32_t lastUpdateTime;
+        bool hasLostSupervision : 1;
+
+        bool loop1 : 1;
+        bool loop2 : 1;
+        bool loop3 : 1;
+        bool tamper : 1;
+        bool lowBat : 1;
     };
 
     struct keypadState_t
     {
-        uint64_t lastUpdateTime;
-        bool hasLostSupervision;
-        
-        std::string phrase;
+        uint32_t lastUpdateTime;
+        bool hasLostSupervision : 1;
+        bool lowBat : 1;
 
         char sequence;
-        bool lowBat;
+
+        // Up to 10 keys and a terminator
+        uint8_t phraseLength;
+        char phrase[11];
+    };
+
+    // Signal levels of every kind of device, kept apart from its state
+    struct linkState_t
+    {
+        uint32_t lastPublishTime;
+        int8_t lastPublishedRssi;
+        uint8_t histogram[RSSI_HISTOGRAM_BINS];
     };
 
-    std::map<uint32_t, sensorState_t> sensorStatusMap;
-    std::map<uint32_t, keypadState_t> keypadStatusMap;
+    DeviceTable<sensorState_t> sensorStatusMap;
+    DeviceTable<keypadState_t> keypadStatusMap;
+    DeviceTable<linkState_t> linkStatusMap;
     uint64_t lastKeyfobPayload;
 };
 
@@ -0,0 +1,58 @@
+#include "eventSink.h"
+
+#include <cstdio>
+#include <sys/time.h>
+
+Event::Event(const std::string &device, const std::string &field, const std::string &value, int qos, bool retain) :
+    device(device),
+    field(field),
+    value(value),
+    qos(qos),
+    retain(retain)
+{
+    timeval now;
+    gettimeofday(&now, nullptr);
+    timestampUs = (uint64_t)now.tv_sec*1000000 + now.tv_usec;
+}
+
+static void appendJsonString(std::string &out, const std::string &in)
+{
+    out += '"';
+    for(char c : in)
+    {
+        if(c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += c;
+        }
+        else if((unsigned char)c < 0x20)
+        {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        }
+        else
+        {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+std::string Event::toJson() const
+{
+    std::string json("{\"timestamp_us\":");
+    json += std::to_string(timestampUs);
+    json += ",\"device\":";
+    appendJsonString(json, device);
+    json += ",\"field\":";
+    appendJsonString(json, field);
+    json += ",\"value\":";
+    appendJsonString(json, value);
+    json += ",\"qos\":";
+    json += std::to_string(qos);
+    json += ",\"retain\":";
+    json += retain ? "true" : "false";
+    json += '}';
+    return json;
+}
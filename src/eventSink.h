@@ -0,0 +1,68 @@
+#ifndef __EVENT_SINK_H__
+#define __EVENT_SINK_H__
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+//
+// Something the receiver has to tell the world about, e.g. device "sensor/123456", field "loop1",
+// value "OPEN".  Receiver-wide events such as "rx_status" have no device.  The MQTT topic is the
+// configured base topic followed by device/field.
+//
+struct Event
+{
+    Event(const std::string &device, const std::string &field, const std::string &value, int qos=1, bool retain=true);
+
+    std::string device;
+    std::string field;
+    std::string value;
+    int qos;
+    bool retain;
+    uint64_t timestampUs;       // Wall clock, microseconds since the epoch
+
+    // Only sent over MQTT 5: how long a broker may hold on to the message, 0 for as long as it
+    // likes, and name/value pairs that go along with it
+    uint32_t expirySec = 0;
+    std::vector<std::pair<std::string, std::string>> properties;
+
+    // The part of the topic below the base topic
+    std::string topic() const {return device.empty() ? field : device + "/" + field;};
+
+    // One line of JSON, without the newline
+    std::string toJson() const;
+};
+
+class EventSink
+{
+  public:
+    virtual ~EventSink() {}
+
+    // Called from the decoding thread, so it has to be quick; may also be called from others
+    virtual void send(const Event &event) = 0;
+};
+
+//
+// Hands every event to each of a number of sinks
+//
+class MultiSink : public EventSink
+{
+  public:
+    void add(std::unique_ptr<EventSink> sink) {m_sinks.push_back(std::move(sink));};
+    bool empty() const {return m_sinks.empty();};
+
+    void send(const Event &event) override
+    {
+        for(auto &sink : m_sinks)
+        {
+            sink->send(event);
+        }
+    };
+
+  private:
+    std::vector<std::unique_ptr<EventSink>> m_sinks;
+};
+
+#endif
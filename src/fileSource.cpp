@@ -0,0 +1,40 @@
+#include "fileSource.h"
+
+#include <iostream>
+#include <vector>
+
+// Same size as the transfers librtlsdr delivers by default
+#define REPLAY_BUFFER_LEN (16*32*512)
+
+FileSource::~FileSource()
+{
+    if(m_file)
+    {
+        fclose(m_file);
+    }
+}
+
+bool FileSource::open()
+{
+    m_file = fopen(m_path.c_str(), "rb");
+    if(!m_file)
+    {
+        std::cout << "Failed to open " << m_path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+int FileSource::run(Callback cb, void *ctx)
+{
+    std::vector<unsigned char> buffer(REPLAY_BUFFER_LEN);
+    size_t n_read;
+    while(!m_stop && (n_read = fread(buffer.data(), 1, buffer.size(), m_file)) > 0)
+    {
+        countBytes(n_read);
+        cb(buffer.data(), n_read, ctx);
+    }
+
+    return ferror(m_file) ? -1 : 0;
+}
@@ -0,0 +1,34 @@
+#ifndef __FILE_SOURCE_H__
+#define __FILE_SOURCE_H__
+
+#include "inputSource.h"
+
+#include <cstdio>
+#include <string>
+
+//
+// A recorded capture (8-bit IQ, as written by rtl_sdr), read as fast as the decoder can take it
+//
+class FileSource : public InputSource
+{
+  public:
+    FileSource(const char *path) : m_path(path) {};
+    ~FileSource();
+
+    bool open() override;
+    bool setFrequency(uint32_t) override {return true;};
+    bool setSampleRate(uint32_t) override {return true;};
+    bool setGain(int, int) override {return true;};
+    bool setFreqCorrection(int) override {return true;};
+    bool isTunable() const override {return false;};
+
+    int run(Callback cb, void *ctx) override;
+    void stop() override {m_stop = true;};
+
+  private:
+    const std::string m_path;
+    FILE *m_file = nullptr;
+    std::atomic<bool> m_stop{false};
+};
+
+#endif
@@ -0,0 +1,250 @@
+#include "frameTap.h"
+
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+FrameTap::~FrameTap()
+{
+    if(m_header)
+    {
+        munmap(m_header, m_size);
+    }
+}
+
+bool FrameTap::open(const char *name, uint32_t slotCount)
+{
+    m_size = sizeof(FrameTapHeader) + slotCount*sizeof(FrameTapRecord);
+
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+    if(fd < 0)
+    {
+        std::cout << "Failed to open shared memory " << name << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Never shrink it: readers still attached from a previous run may have mapped all of it
+    struct stat st;
+    if(fstat(fd, &st) < 0 || ((size_t)st.st_size < m_size && ftruncate(fd, m_size) < 0))
+    {
+        std::cout << "Failed to size shared memory " << name << ": " << strerror(errno) << std::endl;
+        close(fd);
+        return false;
+    }
+
+    void *mem = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mem == MAP_FAILED)
+    {
+        std::cout << "Failed to map shared memory " << name << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    m_header = (FrameTapHeader *)mem;
+    m_slots = (FrameTapRecord *)(m_header + 1);
+
+    //
+    // Start from scratch.  Readers still attached from a previous run see generation 0 until the tap
+    // is ready again, then a new generation, and follow the new run from its first frame.
+    //
+    const uint64_t previous = __atomic_load_n(&m_header->generation, __ATOMIC_RELAXED);
+    __atomic_store_n(&m_header->generation, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    memset(m_slots, 0, slotCount*sizeof(FrameTapRecord));
+    m_header->version = FRAME_TAP_VERSION;
+    m_header->slotCount = slotCount;
+    m_header->slotSize = sizeof(FrameTapRecord);
+    m_header->written = 0;
+
+    timeval now;
+    gettimeofday(&now, nullptr);
+    uint64_t generation = (uint64_t)now.tv_sec*1000000 + now.tv_usec;
+    if(generation <= previous)
+    {
+        generation = previous + 1;
+    }
+    __atomic_store_n(&m_header->magic, FRAME_TAP_MAGIC, __ATOMIC_RELAXED);
+    __atomic_store_n(&m_header->generation, generation, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+void FrameTap::write(uint64_t payload, bool crcOk, bool repaired, float signalDbfs, float peakDbfs, float noiseDbfs)
+{
+    if(!m_header)
+    {
+        return;
+    }
+
+    timeval now;
+    gettimeofday(&now, nullptr);
+
+    const uint64_t frame = m_header->written;
+    FrameTapRecord &slot = m_slots[frame % m_header->slotCount];
+
+    __atomic_store_n(&slot.sequence, 2*frame + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot.timestampUs = (uint64_t)now.tv_sec*1000000 + now.tv_usec;
+    slot.payload = payload;
+    slot.serial = (payload & 0x0FFFFF000000) >> 24;
+    slot.type = (payload & 0x000000FF0000) >> 16;
+    slot.crcOk = crcOk;
+    slot.repaired = repaired;
+    slot.signalDbfs = signalDbfs;
+    slot.peakDbfs = peakDbfs;
+    slot.noiseDbfs = noiseDbfs;
+
+    __atomic_store_n(&slot.sequence, 2*frame + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&m_header->written, frame + 1, __ATOMIC_RELEASE);
+}
+
+FrameTapReader::~FrameTapReader()
+{
+    unmap();
+}
+
+bool FrameTapReader::open(const char *name)
+{
+    m_name = name;
+    if(!map())
+    {
+        return false;
+    }
+
+    m_generation = __atomic_load_n(&m_header->generation, __ATOMIC_ACQUIRE);
+    m_next = __atomic_load_n(&m_header->written, __ATOMIC_ACQUIRE);
+    if(m_generation == 0 || __atomic_load_n(&m_header->generation, __ATOMIC_ACQUIRE) != m_generation)
+    {
+        // The writer is resetting the tap
+        unmap();
+        return false;
+    }
+    return true;
+}
+
+bool FrameTapReader::map()
+{
+    int fd = shm_open(m_name.c_str(), O_RDONLY, 0);
+    if(fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(FrameTapHeader))
+    {
+        close(fd);
+        return false;
+    }
+
+    m_size = st.st_size;
+    void *mem = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mem == MAP_FAILED)
+    {
+        return false;
+    }
+
+    m_header = (const FrameTapHeader *)mem;
+    m_slots = (const FrameTapRecord *)(m_header + 1);
+
+    if(__atomic_load_n(&m_header->magic, __ATOMIC_ACQUIRE) != FRAME_TAP_MAGIC
+        || m_header->version != FRAME_TAP_VERSION
+        || m_header->slotSize != sizeof(FrameTapRecord)
+        || m_size < sizeof(FrameTapHeader) + m_header->slotCount*sizeof(FrameTapRecord))
+    {
+        unmap();
+        return false;
+    }
+    return true;
+}
+
+void FrameTapReader::unmap()
+{
+    if(m_header)
+    {
+        munmap((void *)m_header, m_size);
+        m_header = nullptr;
+        m_slots = nullptr;
+    }
+}
+
+bool FrameTapReader::next(FrameTapRecord &record)
+{
+    while(true)
+    {
+        if(!m_header && !map())
+        {
+            return false;
+        }
+
+        const uint64_t generation = __atomic_load_n(&m_header->generation, __ATOMIC_ACQUIRE);
+        if(generation == 0)
+        {
+            // The writer is resetting the tap
+            return false;
+        }
+
+        if(generation != m_generation)
+        {
+            // The writer was restarted: follow the new run from its first frame, mapping the tap
+            // again if the new run's layout doesn't fit what we have mapped
+            if(m_header->version != FRAME_TAP_VERSION
+                || m_header->slotSize != sizeof(FrameTapRecord)
+                || m_size < sizeof(FrameTapHeader) + m_header->slotCount*sizeof(FrameTapRecord))
+            {
+                unmap();
+                if(!map())
+                {
+                    return false;
+                }
+                continue;
+            }
+            m_generation = generation;
+            m_next = 0;
+        }
+
+        const uint64_t written = __atomic_load_n(&m_header->written, __ATOMIC_ACQUIRE);
+        const uint32_t slotCount = m_header->slotCount;
+        if(m_next >= written)
+        {
+            return false;
+        }
+
+        // Too far behind for the frame to still be there
+        if(written - m_next > slotCount)
+        {
+            m_missed += written - slotCount - m_next;
+            m_next = written - slotCount;
+        }
+
+        const FrameTapRecord &slot = m_slots[m_next % slotCount];
+        const uint64_t before = __atomic_load_n(&slot.sequence, __ATOMIC_ACQUIRE);
+        memcpy(&record, (const void *)&slot, sizeof(record));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        const uint64_t after = __atomic_load_n(&slot.sequence, __ATOMIC_RELAXED);
+
+        // Reset by a restarted writer while we were copying it; start over with the new run
+        if(__atomic_load_n(&m_header->generation, __ATOMIC_RELAXED) != generation)
+        {
+            continue;
+        }
+
+        if(before == after && before == 2*m_next + 2)
+        {
+            m_next++;
+            return true;
+        }
+
+        // Overwritten while we were copying it
+        m_missed++;
+        m_next++;
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef __FRAME_TAP_H__
+#define __FRAME_TAP_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+//
+// Ring of decoded frames in POSIX shared memory (/dev/shm/<name>) for local consumers.
+//
+// There is one writer, the decoder, and any number of readers, none of which ever block the writer.
+// Frame n goes into slot n % slotCount.  While a slot is being written its sequence is 2n+1, and
+// once it is complete it is 2n+2.  A reader that wants frame n reads the sequence, copies the record
+// and reads the sequence again: if both reads were 2n+2 the copy is good, and a higher value means
+// the writer has lapped the reader.
+//
+// Every time a writer opens the tap it gives it a new generation, so readers that stay attached across
+// a decoder restart start over with the new run's first frame.  The generation is 0 while the writer
+// is resetting the tap.
+//
+
+#define FRAME_TAP_MAGIC   0x33343546u  // "F543"
+#define FRAME_TAP_VERSION 3
+
+struct FrameTapHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t slotSize;
+    uint64_t generation;        // Start time of the writer's run, in microseconds since the epoch
+    uint64_t written;           // Number of frames completely written
+};
+
+struct FrameTapRecord
+{
+    uint64_t sequence;
+    uint64_t timestampUs;       // Wall clock, microseconds since the epoch
+    uint64_t payload;           // Including the sync bits
+    uint32_t serial;
+    uint8_t type;
+    uint8_t crcOk;              // The frame passed CRC (possibly after repair)
+    uint8_t repaired;           // Bits were flipped to make it pass
+    uint8_t reserved;
+    float signalDbfs;           // Mean level of the frame's high chips
+    float peakDbfs;             // Strongest high chip
+    float noiseDbfs;            // Mean level of the frame's low chips
+    uint32_t reserved2;
+};
+
+class FrameTap
+{
+  public:
+    FrameTap() = default;
+    ~FrameTap();
+
+    bool open(const char *name, uint32_t slotCount);
+    void write(uint64_t payload, bool crcOk, bool repaired, float signalDbfs, float peakDbfs, float noiseDbfs);
+
+  private:
+    FrameTapHeader *m_header = nullptr;
+    FrameTapRecord *m_slots = nullptr;
+    size_t m_size = 0;
+};
+
+class FrameTapReader
+{
+  public:
+    FrameTapReader() = default;
+    ~FrameTapReader();
+
+    // Starts with the next frame written after opening
+    bool open(const char *name);
+
+    // Copies out the next frame if there is one.  Frames the writer overwrote before they could be
+    // read are skipped and counted, also when a restarted writer got ahead of the reader.
+    bool next(FrameTapRecord &record);
+    uint64_t missed() const {return m_missed;};
+
+  private:
+    bool map();
+    void unmap();
+
+    std::string m_name;
+    const FrameTapHeader *m_header = nullptr;
+    const FrameTapRecord *m_slots = nullptr;
+    size_t m_size = 0;
+    uint64_t m_generation = 0;
+    uint64_t m_next = 0;
+    uint64_t m_missed = 0;
+};
+
+#endif
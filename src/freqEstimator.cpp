@@ -0,0 +1,277 @@
+#include "freqEstimator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstring>
+#include <iostream>
+
+// Largest buffer handed to the background thread, in bytes (the default librtlsdr transfer size)
+#define MAX_BUFFER_LEN (16*32*512)
+
+// 4096 points gives 244Hz bins at 1MS/s; the peak is interpolated well below that
+#define FFT_SIZE 4096
+
+// Only blocks with at least this fraction of the strongest block's energy are part of the burst
+#define BURST_ENERGY_RATIO 0.5f
+
+// ...and the burst has to stand this far above the quietest blocks to be worth measuring
+#define MIN_BURST_TO_NOISE 4.0f
+
+// Smoothing of the tracked offset; a single sensor's crystal shouldn't steer the tuner
+#define TRACKING_ALPHA 0.1f
+
+// Retune once the tracked offset is this far off and enough bursts have been seen since the last
+// correction for the estimate to have settled
+#define CORRECTION_THRESHOLD_PPM 2.0f
+#define MIN_ESTIMATES_PER_CORRECTION 10
+
+typedef std::complex<float> cfloat;
+
+static void fft(std::vector<cfloat> &data)
+{
+    const size_t n = data.size();
+
+    for(size_t ii = 1, jj = 0; ii < n; ++ii)
+    {
+        size_t bit = n >> 1;
+        for(; jj & bit; bit >>= 1)
+        {
+            jj ^= bit;
+        }
+        jj ^= bit;
+
+        if(ii < jj)
+        {
+            std::swap(data[ii], data[jj]);
+        }
+    }
+
+    for(size_t len = 2; len <= n; len <<= 1)
+    {
+        const cfloat step = std::polar(1.0f, (float)(-2.0*M_PI/len));
+        for(size_t ii = 0; ii < n; ii += len)
+        {
+            cfloat w(1.0f, 0.0f);
+            for(size_t jj = 0; jj < len/2; ++jj)
+            {
+                cfloat u = data[ii + jj];
+                cfloat v = data[ii + jj + len/2]*w;
+                data[ii + jj] = u + v;
+                data[ii + jj + len/2] = u - v;
+                w *= step;
+            }
+        }
+    }
+}
+
+FrequencyEstimator::FrequencyEstimator(uint32_t sampleRate, uint32_t centerFreq, int initialPpm) :
+    m_sampleRate(sampleRate),
+    m_centerFreq(centerFreq),
+    m_trackedCenterFreq(centerFreq),
+    m_correctionPpm(initialPpm),
+    m_buffer(MAX_BUFFER_LEN),
+    m_busy(false)
+{
+    m_thread = std::thread(&FrequencyEstimator::run, this);
+}
+
+FrequencyEstimator::~FrequencyEstimator()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cond.notify_one();
+    m_thread.join();
+}
+
+void FrequencyEstimator::handleBuffer(const unsigned char *buf, uint32_t len)
+{
+    // Still working on the last one
+    if(m_busy.load())
+    {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+    if(!lock.owns_lock())
+    {
+        return;
+    }
+
+    m_bufferLen = std::min<uint32_t>(len, MAX_BUFFER_LEN);
+    memcpy(m_buffer.data(), buf, m_bufferLen);
+    m_busy = true;
+    lock.unlock();
+
+    m_cond.notify_one();
+}
+
+void FrequencyEstimator::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while(true)
+    {
+        m_cond.wait(lock, [this]{return m_stop || m_busy.load();});
+        if(m_stop)
+        {
+            break;
+        }
+
+        lock.unlock();
+        float offsetHz;
+        if(estimate(offsetHz))
+        {
+            track(offsetHz);
+        }
+        lock.lock();
+
+        m_busy = false;
+    }
+}
+
+bool FrequencyEstimator::estimate(float &offsetHz)
+{
+    const uint32_t nBlocks = (m_bufferLen/2)/FFT_SIZE;
+    if(nBlocks < 2)
+    {
+        return false;
+    }
+
+    //
+    // Find the blocks that hold the burst, and the quiet ones around it
+    //
+    std::vector<float> energy(nBlocks, 0.0f);
+    for(uint32_t block = 0; block < nBlocks; ++block)
+    {
+        const unsigned char *iq = m_buffer.data() + block*FFT_SIZE*2;
+        for(int ii = 0; ii < FFT_SIZE; ++ii)
+        {
+            float real = iq[2*ii] - 127.4f;
+            float imag = iq[2*ii + 1] - 127.4f;
+            energy[block] += real*real + imag*imag;
+        }
+    }
+
+    std::vector<float> sorted(energy);
+    std::sort(sorted.begin(), sorted.end());
+    const float quietEnergy = sorted[nBlocks/4];
+    const float burstEnergy = sorted[nBlocks - 1];
+
+    if(burstEnergy < quietEnergy*MIN_BURST_TO_NOISE)
+    {
+        return false;
+    }
+
+    //
+    // The dongle's DC offset is measured on the quiet blocks rather than removed per block, since a
+    // burst that is already close to the tuned frequency would be removed along with it
+    //
+    cfloat dc(0.0f, 0.0f);
+    uint32_t quietBlocks = 0;
+    for(uint32_t block = 0; block < nBlocks; ++block)
+    {
+        if(energy[block] > quietEnergy)
+        {
+            continue;
+        }
+
+        const unsigned char *iq = m_buffer.data() + block*FFT_SIZE*2;
+        for(int ii = 0; ii < FFT_SIZE; ++ii)
+        {
+            dc += cfloat(iq[2*ii] - 127.4f, iq[2*ii + 1] - 127.4f);
+        }
+        quietBlocks++;
+    }
+    dc /= (float)(quietBlocks*FFT_SIZE);
+
+    //
+    // Average the power spectrum of the burst blocks
+    //
+    std::vector<float> power(FFT_SIZE, 0.0f);
+    std::vector<cfloat> spectrum(FFT_SIZE);
+    for(uint32_t block = 0; block < nBlocks; ++block)
+    {
+        if(energy[block] < burstEnergy*BURST_ENERGY_RATIO)
+        {
+            continue;
+        }
+
+        const unsigned char *iq = m_buffer.data() + block*FFT_SIZE*2;
+        for(int ii = 0; ii < FFT_SIZE; ++ii)
+        {
+            float window = 0.5f - 0.5f*std::cos(2.0f*(float)M_PI*ii/FFT_SIZE);
+            spectrum[ii] = (cfloat(iq[2*ii] - 127.4f, iq[2*ii + 1] - 127.4f) - dc)*window;
+        }
+
+        fft(spectrum);
+
+        for(int ii = 0; ii < FFT_SIZE; ++ii)
+        {
+            power[ii] += std::norm(spectrum[ii]);
+        }
+    }
+
+    //
+    // The carrier is the strongest line of an OOK burst; interpolate between bins around it
+    //
+    const int peak = std::max_element(power.begin(), power.end()) - power.begin();
+    const float before = power[(peak + FFT_SIZE - 1) % FFT_SIZE];
+    const float at = power[peak];
+    const float after = power[(peak + 1) % FFT_SIZE];
+
+    float delta = 0.0f;
+    const float curvature = before - 2.0f*at + after;
+    if(curvature != 0.0f)
+    {
+        delta = 0.5f*(before - after)/curvature;
+    }
+
+    const float bin = ((peak < FFT_SIZE/2) ? peak : (peak - FFT_SIZE)) + delta;
+    offsetHz = bin*m_sampleRate/FFT_SIZE;
+
+    return true;
+}
+
+void FrequencyEstimator::track(float offsetHz)
+{
+    // The same ppm error is a different offset at another frequency
+    const uint32_t centerFreq = m_centerFreq.load();
+    if(centerFreq != m_trackedCenterFreq)
+    {
+        m_trackedCenterFreq = centerFreq;
+        m_estimatesSinceCorrection = 0;
+    }
+    const float ppm = offsetHz/(centerFreq*1e-6f);
+
+    if(m_estimatesSinceCorrection == 0)
+    {
+        m_trackedPpm = ppm;
+    }
+    else
+    {
+        m_trackedPpm = (1.0f - TRACKING_ALPHA)*m_trackedPpm + TRACKING_ALPHA*ppm;
+    }
+    m_estimatesSinceCorrection++;
+
+    //
+    // The tuner thinks its crystal is off by m_correctionPpm.  A carrier that shows up above the
+    // tuned frequency means the LO is low, i.e. the crystal runs slower than that.
+    //
+    if(m_offsetCb)
+    {
+        m_offsetCb(offsetHz, m_correctionPpm - m_trackedPpm);
+    }
+
+    if(m_correctionCb && m_estimatesSinceCorrection >= MIN_ESTIMATES_PER_CORRECTION
+        && std::fabs(m_trackedPpm) >= CORRECTION_THRESHOLD_PPM)
+    {
+        m_correctionPpm -= (int)std::lround(m_trackedPpm);
+        m_estimatesSinceCorrection = 0;
+
+        std::cout << "Carrier offset " << m_trackedPpm << " ppm, correcting tuner by " << m_correctionPpm << " ppm" << std::endl;
+        m_correctionCb(m_correctionPpm);
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef __FREQ_ESTIMATOR_H__
+#define __FREQ_ESTIMATOR_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+// Estimates how far the 345MHz carrier sits from the tuned frequency by looking at the spectrum of
+// received bursts.  The receive callback hands over a buffer that contains a burst and the FFT work
+// happens on a background thread, so buffers that arrive while it is busy are simply skipped.
+//
+class FrequencyEstimator
+{
+  public:
+    FrequencyEstimator(uint32_t sampleRate, uint32_t centerFreq, int initialPpm);
+    ~FrequencyEstimator();
+
+    // Called from the receive callback with a raw IQ buffer that contains a burst
+    void handleBuffer(const unsigned char *buf, uint32_t len);
+
+    // Called from the background thread with every new estimate of the carrier offset and of the
+    // dongle's crystal error.  The correction callback gets the new total ppm correction whenever the
+    // tracked offset has drifted far enough to retune.
+    void setOffsetCallback(std::function<void(float offsetHz, float ppm)> cb) {m_offsetCb = cb;};
+    void setCorrectionCallback(std::function<void(int ppm)> cb) {m_correctionCb = cb;};
+
+    // After retuning; may be called from any thread.  Tracking starts over at the new frequency.
+    void setCenterFrequency(uint32_t centerFreq) {m_centerFreq = centerFreq;};
+
+  private:
+    void run();
+    bool estimate(float &offsetHz);
+    void track(float offsetHz);
+
+    const uint32_t m_sampleRate;
+    std::atomic<uint32_t> m_centerFreq;
+    uint32_t m_trackedCenterFreq;
+    int m_correctionPpm;
+
+    std::function<void(float, float)> m_offsetCb;
+    std::function<void(int)> m_correctionCb;
+
+    std::vector<unsigned char> m_buffer;
+    uint32_t m_bufferLen = 0;
+    std::atomic<bool> m_busy;
+    bool m_stop = false;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::thread m_thread;
+
+    float m_trackedPpm = 0.0f;
+    unsigned int m_estimatesSinceCorrection = 0;
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef __INPUT_SOURCE_H__
+#define __INPUT_SOURCE_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+//
+// Where the 8-bit IQ samples come from: a local dongle, an rtl_tcp server or a recorded capture.
+// Every source hands the callback the same interleaved unsigned I/Q bytes librtlsdr does.
+//
+class InputSource
+{
+  public:
+    // Same shape as librtlsdr's async callback
+    typedef void (*Callback)(unsigned char *buf, uint32_t len, void *ctx);
+
+    struct Stats
+    {
+        uint64_t bytes;             // IQ bytes handed to the callback
+        uint32_t gaps;              // Times the stream was interrupted
+        uint64_t samplesLost;       // Estimated samples missed during those interruptions
+        uint32_t reconnects;
+    };
+
+    virtual ~InputSource() {}
+
+    virtual bool open() = 0;
+    virtual bool setFrequency(uint32_t freq) = 0;
+    virtual bool setSampleRate(uint32_t rate) = 0;
+    virtual bool setGain(int agc, int gain) = 0;
+    virtual bool setFreqCorrection(int ppm) = 0;
+
+    // Whether tuning commands reach a receiver at all; a recording can't be retuned
+    virtual bool isTunable() const {return true;};
+
+    // The gains setGain() accepts, in tenths of a dB from lowest to highest; empty if not known (yet)
+    virtual std::vector<int> tunerGains() {return {};};
+
+    // Streams into cb until stop() is called or the source runs out.  Returns 0 if it ended cleanly.
+    virtual int run(Callback cb, void *ctx) = 0;
+    virtual void stop() = 0;
+
+    // Real-time scheduling for a thread the source reads from the receiver on, if it has one of its
+    // own.  Takes effect at run().
+    void setIoRealtime(int cpu, int priority) {m_ioCpu = cpu; m_ioPriority = priority;};
+
+    Stats stats() const
+    {
+        Stats s;
+        s.bytes = m_bytes.load();
+        s.gaps = m_gaps.load();
+        s.samplesLost = m_samplesLost.load();
+        s.reconnects = m_reconnects.load();
+        return s;
+    };
+
+  protected:
+    void countBytes(uint32_t len) {m_bytes += len;};
+    void countGap(uint64_t samplesLost) {m_gaps++; m_samplesLost += samplesLost;};
+    // More samples lost in a gap that was already counted
+    void countLost(uint64_t samplesLost) {m_samplesLost += samplesLost;};
+    void countReconnect() {m_reconnects++;};
+
+    int m_ioCpu = -1;
+    int m_ioPriority = 0;
+
+  private:
+    std::atomic<uint64_t> m_bytes{0};
+    std::atomic<uint32_t> m_gaps{0};
+    std::atomic<uint64_t> m_samplesLost{0};
+    std::atomic<uint32_t> m_reconnects{0};
+};
+
+#endif
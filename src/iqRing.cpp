@@ -0,0 +1,202 @@
+#include "iqRing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+
+// Same size as the transfers librtlsdr delivers by default; larger buffers take several slots
+#define IQ_RING_SLOT_LEN (16*32*512)
+
+// What a dump holds around the trigger, plus room for the dump thread to copy it out before the
+// callback catches up with it
+#define IQ_RING_PRE_SEC    (3)
+#define IQ_RING_POST_SEC   (1)
+#define IQ_RING_MARGIN_SEC (2)
+
+// At most one dump per minute, and a limit on the disk a run can fill
+#define IQ_DUMP_MIN_SEC (60)
+#define IQ_DUMP_MAX     (100)
+
+// How often the dump thread looks for a trigger, and whether the buffers after it have arrived
+#define IQ_DUMP_POLL_MS (50)
+
+static uint32_t slotsFor(uint32_t sampleRate, uint32_t seconds)
+{
+    return ((uint64_t)sampleRate*2*seconds + IQ_RING_SLOT_LEN - 1)/IQ_RING_SLOT_LEN;
+}
+
+IqRing::IqRing(const char *dir, uint32_t sampleRate) :
+    m_dir(dir),
+    m_slotCount(slotsFor(sampleRate, IQ_RING_PRE_SEC + IQ_RING_POST_SEC + IQ_RING_MARGIN_SEC)),
+    m_preSlots(slotsFor(sampleRate, IQ_RING_PRE_SEC)),
+    m_postSlots(slotsFor(sampleRate, IQ_RING_POST_SEC)),
+    m_data((size_t)m_slotCount*IQ_RING_SLOT_LEN),
+    m_lengths(m_slotCount),
+    m_sequences(new std::atomic<uint64_t>[m_slotCount]),
+    m_written(0),
+    m_triggerState(TRIGGER_IDLE),
+    m_suppressedCount(0)
+{
+    for(uint32_t ii = 0; ii < m_slotCount; ++ii)
+    {
+        m_sequences[ii] = 0;
+    }
+
+    std::cout << "Keeping " << m_slotCount << " buffers (" << m_data.size()/(1024*1024) << " MiB) of IQ for captures in " << m_dir << std::endl;
+    m_thread = std::thread(&IqRing::run, this);
+}
+
+IqRing::~IqRing()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cond.notify_one();
+    m_thread.join();
+}
+
+void IqRing::push(const unsigned char *buf, uint32_t len)
+{
+    while(len > 0)
+    {
+        const uint32_t chunk = std::min<uint32_t>(len, IQ_RING_SLOT_LEN);
+        const uint64_t n = m_written.load(std::memory_order_relaxed);
+        const uint32_t slot = n % m_slotCount;
+
+        m_sequences[slot].store(2*n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        memcpy(m_data.data() + (size_t)slot*IQ_RING_SLOT_LEN, buf, chunk);
+        m_lengths[slot] = chunk;
+
+        m_sequences[slot].store(2*n + 2, std::memory_order_release);
+        m_written.store(n + 1, std::memory_order_release);
+
+        buf += chunk;
+        len -= chunk;
+    }
+}
+
+void IqRing::trigger(const std::string &reason)
+{
+    int idle = TRIGGER_IDLE;
+    if(!m_triggerState.compare_exchange_strong(idle, TRIGGER_FILLING, std::memory_order_acquire))
+    {
+        m_suppressedCount.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    m_triggerSlot = m_written.load(std::memory_order_acquire);
+    strncpy(m_reason, reason.c_str(), sizeof(m_reason) - 1);
+    m_reason[sizeof(m_reason) - 1] = '\0';
+    m_triggerState.store(TRIGGER_PENDING, std::memory_order_release);
+}
+
+void IqRing::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while(true)
+    {
+        // Triggers don't notify, so look for one every so often
+        m_cond.wait_for(lock, std::chrono::milliseconds(IQ_DUMP_POLL_MS),
+            [this]{return m_stop || m_triggerState.load(std::memory_order_acquire) == TRIGGER_PENDING;});
+        if(m_stop)
+        {
+            break;
+        }
+        if(m_triggerState.load(std::memory_order_acquire) != TRIGGER_PENDING)
+        {
+            continue;
+        }
+
+        const uint64_t triggerSlot = m_triggerSlot;
+        const std::string reason = m_reason;
+
+        const time_t now = time(nullptr);
+        if(m_dumpCount >= IQ_DUMP_MAX || (now - m_lastDumpTime) < IQ_DUMP_MIN_SEC)
+        {
+            m_suppressedCount.fetch_add(1, std::memory_order_relaxed);
+            m_triggerState.store(TRIGGER_IDLE, std::memory_order_release);
+            continue;
+        }
+        m_lastDumpTime = now;
+        m_dumpCount++;
+
+        //
+        // Wait for the buffers after the trigger; if reception stops first, save what there is
+        //
+        const uint64_t first = (triggerSlot > m_preSlots) ? (triggerSlot - m_preSlots) : 0;
+        uint64_t end = triggerSlot + m_postSlots;
+        while(m_written.load(std::memory_order_acquire) < end && !m_stop)
+        {
+            m_cond.wait_for(lock, std::chrono::milliseconds(IQ_DUMP_POLL_MS));
+        }
+        end = std::min(end, m_written.load(std::memory_order_acquire));
+
+        const uint32_t suppressed = m_suppressedCount.exchange(0, std::memory_order_relaxed);
+        lock.unlock();
+
+        dump(first, end, reason);
+        if(suppressed)
+        {
+            std::cout << "Skipped " << suppressed << " capture triggers since the last capture" << std::endl;
+        }
+
+        lock.lock();
+        m_triggerState.store(TRIGGER_IDLE, std::memory_order_release);
+    }
+}
+
+void IqRing::dump(uint64_t first, uint64_t end, const std::string &reason)
+{
+    time_t now = time(nullptr);
+    tm local;
+    localtime_r(&now, &local);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+    const std::string path = m_dir + "/" + stamp + "-" + reason + ".cu8";
+
+    FILE *file = fopen(path.c_str(), "wb");
+    if(!file)
+    {
+        std::cout << "Failed to open " << path << ": " << strerror(errno) << std::endl;
+        return;
+    }
+
+    std::vector<unsigned char> scratch(IQ_RING_SLOT_LEN);
+    uint64_t saved = 0;
+    for(uint64_t n = first; n < end; ++n)
+    {
+        const uint32_t slot = n % m_slotCount;
+        const uint64_t before = m_sequences[slot].load(std::memory_order_acquire);
+        if(before != 2*n + 2)
+        {
+            std::cout << "Capture fell behind reception, cutting it short" << std::endl;
+            break;
+        }
+
+        const uint32_t len = m_lengths[slot];
+        memcpy(scratch.data(), m_data.data() + (size_t)slot*IQ_RING_SLOT_LEN, len);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(m_sequences[slot].load(std::memory_order_relaxed) != before)
+        {
+            std::cout << "Capture fell behind reception, cutting it short" << std::endl;
+            break;
+        }
+
+        if(fwrite(scratch.data(), 1, len, file) != len)
+        {
+            std::cout << "Failed to write " << path << ": " << strerror(errno) << std::endl;
+            break;
+        }
+        saved += len;
+    }
+
+    fclose(file);
+    std::cout << "Saved " << saved/2 << " samples of IQ (" << reason << ") to " << path << std::endl;
+}
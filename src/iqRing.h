@@ -0,0 +1,73 @@
+#ifndef __IQ_RING_H__
+#define __IQ_RING_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//
+// The last few seconds of raw IQ, so that a misbehaving sensor can be saved together with what led up
+// to it.
+//
+// The receive callback copies each buffer into the next slot of a preallocated ring and does nothing
+// else.  A trigger only notes which buffer it came in, without taking a lock; a background thread
+// picks it up, applies the rate limits, waits for the buffers after it to arrive, then copies the
+// window out one slot at a time and writes it as raw 8-bit IQ that -r can replay.  Slots use the same
+// odd/even sequence scheme as the frame tap, so a slot the callback overwrote while it was being
+// copied ends the dump early instead of holding up the callback.
+//
+class IqRing
+{
+  public:
+    IqRing(const char *dir, uint32_t sampleRate);
+    ~IqRing();
+
+    // From the receive callback.  The buffer has to be copied: librtlsdr hands it to USB again as soon
+    // as the callback returns, and the other sources reuse theirs for the next block.
+    void push(const unsigned char *buf, uint32_t len);
+
+    // Saves the window around the latest buffer, unless a dump is in progress or one was made too
+    // recently.  The reason becomes part of the file name.  Never waits, so that the decoder can call
+    // it from a real-time thread.
+    void trigger(const std::string &reason);
+
+  private:
+    void run();
+    void dump(uint64_t first, uint64_t end, const std::string &reason);
+
+    const std::string m_dir;
+    const uint32_t m_slotCount;
+    const uint32_t m_preSlots;
+    const uint32_t m_postSlots;
+
+    std::vector<unsigned char> m_data;
+    std::vector<uint32_t> m_lengths;
+    std::unique_ptr<std::atomic<uint64_t>[]> m_sequences;
+    std::atomic<uint64_t> m_written;
+
+    // A trigger is filled in by whoever moves m_triggerState from idle to filling, and belongs to the
+    // dump thread once it is pending, until that thread sets it back to idle
+    enum {TRIGGER_IDLE, TRIGGER_FILLING, TRIGGER_PENDING};
+    std::atomic<int> m_triggerState;
+    uint64_t m_triggerSlot = 0;
+    char m_reason[64];
+    std::atomic<uint32_t> m_suppressedCount;
+
+    // Only for the dump thread
+    time_t m_lastDumpTime = 0;
+    uint32_t m_dumpCount = 0;
+
+    // Only for stopping the dump thread; triggers don't touch them
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_stop = false;
+    std::thread m_thread;
+};
+
+#endif
@@ -1,9 +1,21 @@
 #include "digitalDecoder.h"
 #include "analogDecoder.h"
 #include "mqtt.h"
-#include "mqtt_config.h"
-
-#include <rtl-sdr.h>
+#include "mqtt5.h"
+#include "mqttSink.h"
+#include "batchedSink.h"
+#include "config.h"
+#include "freqEstimator.h"
+#include "frameTap.h"
+#include "iqRing.h"
+#include "burstArchive.h"
+#include "rtlSdrSource.h"
+#include "rtlTcpSource.h"
+#include "fileSource.h"
+#include "archiveSource.h"
+#include "realtime.h"
+#include "deviceSnapshot.h"
+#include "autoGain.h"
 
 #include <iostream>
 #include <cmath>
@@ -11,12 +23,54 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <atomic>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include <sys/stat.h>
 
 // TODO: MQTT Will doesn't seem to be working with HA as expected
 
+// A USB buffer needs this many samples above the OOK threshold to count as holding a burst
+#define BURST_MIN_HIGH_SAMPLES 64
+
+// Don't publish the measured frequency offset more than once per minute
+#define FREQ_OFFSET_MIN_SEC (60)
+#define FREQ_OFFSET_TOPIC "rx_freq_offset"
+
+// Frames kept in the shared memory tap; about a day's worth of traffic for a typical house
+#define FRAME_TAP_SLOTS 4096
+
+// How often the input throughput and gaps are published
+#define INPUT_STATS_SEC (60)
+#define INPUT_STATS_DEVICE "rx_input"
+
+#define AUTO_GAIN_DEVICE "rx_gain"
+
+// Devices the tables have room for before real-time reception starts
+#define REALTIME_DEVICE_RESERVE (1024)
+
+// Heap faulted in and locked for what the decoder allocates while receiving: events, snapshots, sink batches
+#define REALTIME_HEAP_RESERVE (16*1024*1024)
+
 float magLut[0x10000];
 
+struct ReceiveContext
+{
+    AnalogDecoder *aDecoder;
+    FrequencyEstimator *freqEstimator;
+    IqRing *iqRing;
+    BurstArchive *burstArchive;
+    CallbackTiming *timing;
+    AutoGain *autoGain;
+};
+
  void alarmHandler(int signal)
  {
      std::cout << "Error Detected!" << std::endl;
@@ -25,44 +79,61 @@ float magLut[0x10000];
 void usage(const char *argv0)
 {
     std::cout << "Usage: " << std::endl
-        << argv0 << " [-d <device-id>] [-f <frequency in Hz]" << std::endl;
+        << argv0 << " [-d <device-id>] [-f <frequency in Hz>] [-g <gain in tenths of a dB>|auto] [-p <ppm correction>] [-t <rtl_tcp host>[:<port>]] [-r <replay file or burst archive>] [-m <shared memory name>] [-c <config file>]" << std::endl
+        << "    [-i <directory for IQ captures>] [-b <burst archive directory>] [-T <from>[,<to>]] [-S <serial>] (UNIX times; -T and -S pick what -r replays from an archive)" << std::endl
+        << "    [-u <snapshot socket path>] [-R <decoder CPU>[,<input CPU>]] (real-time; -1 leaves a thread unpinned)" << std::endl
+        << "    [-o mqtt|mqtt5|json:<file or - for stdout>|udp:<port>] (may be repeated; defaults to mqtt)" << std::endl;
 }
 
 int main(int argc, char ** argv)
 {
+    // SIGHUP is picked up by the control thread, so block it before any other thread is started
+    sigset_t hupSignals;
+    sigemptyset(&hupSignals);
+    sigaddset(&hupSignals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &hupSignals, nullptr);
+    
+    Config baseConfig;
     const char *mqttHost = std::getenv("MQTT_HOST");
-    if ((mqttHost == NULL) || (std::char_traits<char>::length(mqttHost) == 0))
+    if ((mqttHost != NULL) && (std::char_traits<char>::length(mqttHost) > 0))
     {
-        mqttHost = MQTT_HOST;
+        baseConfig.mqttHost = mqttHost;
     }
     const char *mqttPortStr = std::getenv("MQTT_PORT");
-    int mqttPort = MQTT_PORT;
     if ((mqttPortStr) && (std::char_traits<char>::length(mqttPortStr) > 0))
     {
-        mqttPort = std::stoi(mqttPortStr);
+        baseConfig.mqttPort = std::stoi(mqttPortStr);
     }
     const char *mqttUsername = std::getenv("MQTT_USERNAME");
-    if ((mqttUsername == NULL) || (std::char_traits<char>::length(mqttUsername) == 0))
+    if ((mqttUsername != NULL) && (std::char_traits<char>::length(mqttUsername) > 0))
     {
-        mqttUsername = MQTT_USERNAME;
+        baseConfig.mqttUsername = mqttUsername;
     }
     const char *mqttPassword = std::getenv("MQTT_PASSWORD");
-    if ((mqttPassword == NULL) || (std::char_traits<char>::length(mqttPassword) == 0))
+    if ((mqttPassword != NULL) && (std::char_traits<char>::length(mqttPassword) > 0))
     {
-        mqttPassword = MQTT_PASSWORD;
+        baseConfig.mqttPassword = mqttPassword;
     }
     
-    Mqtt mqtt = Mqtt("sensors345", mqttHost, mqttPort, mqttUsername, mqttPassword, "security/sensors345/rx_status", "FAILED");
-    DigitalDecoder dDecoder = DigitalDecoder(mqtt);
-    AnalogDecoder aDecoder;
-    
     int devId = 0;
-    int freq = 345000000;
-    int gain = 364;
     int sampleRate = 1000000;
-    int agc = 0;
+    int ppm = 0;
+    const char *replayPath = nullptr;
+    const char *rtlTcpAddress = nullptr;
+    const char *frameTapName = nullptr;
+    const char *configPath = nullptr;
+    const char *captureDir = nullptr;
+    const char *archiveDir = nullptr;
+    uint64_t archiveFromUs = 0;
+    uint64_t archiveToUs = UINT64_MAX;
+    uint32_t archiveSerial = 0;
+    const char *snapshotPath = nullptr;
+    bool realtime = false;
+    int decoderCpu = -1;
+    int inputCpu = -1;
+    std::vector<std::string> outputs;
     signed char c;
-    while ((c = getopt(argc, argv, "hd:f:g:s:a:")) != -1)
+    while ((c = getopt(argc, argv, "hd:f:g:s:a:p:t:r:m:c:o:i:b:T:S:u:R:")) != -1)
     {
         switch(c)
         {
@@ -78,12 +149,13 @@ int main(int argc, char ** argv)
             }
             case 'f':
             {
-                freq = atoi(optarg);
+                baseConfig.frequency = atoi(optarg);
                 break;
             }
             case 'g':
             {
-                gain = atoi(optarg);
+                baseConfig.autoGain = (strcmp(optarg, "auto") == 0);
+                baseConfig.gain = baseConfig.autoGain ? baseConfig.gain : atoi(optarg);
                 break;
             }
             case 's':
@@ -93,7 +165,110 @@ int main(int argc, char ** argv)
             }
             case 'a':
             {
-                agc= atoi(optarg);
+                baseConfig.agc = atoi(optarg);
+                break;
+            }
+            case 'p':
+            {
+                ppm = atoi(optarg);
+                break;
+            }
+            case 't':
+            {
+                rtlTcpAddress = optarg;
+                break;
+            }
+            case 'r':
+            {
+                replayPath = optarg;
+                break;
+            }
+            case 'm':
+            {
+                frameTapName = optarg;
+                break;
+            }
+            case 'c':
+            {
+                configPath = optarg;
+                break;
+            }
+            case 'o':
+            {
+                outputs.push_back(optarg);
+                break;
+            }
+            case 'i':
+            {
+                captureDir = optarg;
+                break;
+            }
+            case 'b':
+            {
+                archiveDir = optarg;
+                break;
+            }
+            case 'T':
+            {
+                char *end = nullptr;
+                archiveFromUs = strtoull(optarg, &end, 10)*1000000;
+                bool valid = (end != optarg);
+                if(valid && *end == ',')
+                {
+                    const char *toStr = end + 1;
+                    archiveToUs = strtoull(toStr, &end, 10)*1000000;
+                    valid = (end != toStr);
+                }
+                if(!valid || *end != '\0' || archiveFromUs >= archiveToUs)
+                {
+                    std::cerr << "Bad time range '" << optarg << "' for -T, expected <from>[,<to>] with from before to" << std::endl;
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            }
+            case 'S':
+            {
+                char *end = nullptr;
+                const unsigned long serial = strtoul(optarg, &end, 10);
+                if(end == optarg || *end != '\0' || serial == 0 || serial > 0xFFFFF)
+                {
+                    std::cerr << "Bad serial '" << optarg << "' for -S" << std::endl;
+                    usage(argv[0]);
+                    exit(1);
+                }
+                archiveSerial = serial;
+                break;
+            }
+            case 'u':
+            {
+                snapshotPath = optarg;
+                break;
+            }
+            case 'R':
+            {
+                // The input thread shares the decoder's CPU unless given one of its own; -1 leaves a
+                // thread unpinned
+                const long cpuCount = sysconf(_SC_NPROCESSORS_CONF);
+                char *end = nullptr;
+                const long decoder = strtol(optarg, &end, 10);
+                bool valid = (end != optarg);
+                long input = decoder;
+                if(valid && *end == ',')
+                {
+                    const char *inputStr = end + 1;
+                    input = strtol(inputStr, &end, 10);
+                    valid = (end != inputStr);
+                }
+                if(!valid || *end != '\0' || decoder < -1 || decoder >= cpuCount || input < -1 || input >= cpuCount)
+                {
+                    std::cerr << "Bad CPUs '" << optarg << "' for -R, expected <decoder CPU>[,<input CPU>] from -1 to " << (cpuCount - 1) << std::endl;
+                    usage(argv[0]);
+                    exit(1);
+                }
+                decoderCpu = decoder;
+                inputCpu = input;
+                realtime = true;
                 break;
             }
             default: // including '?' unknown character
@@ -106,81 +281,81 @@ int main(int argc, char ** argv)
     }
     
     //
-    // Open the device
+    // The config file goes on top of the defaults, environment and flags
     //
-    if(rtlsdr_get_device_count() < 1)
-    {
-        std::cout << "Could not find any devices" << std::endl;
-        return -1;
-    }
-        
-    rtlsdr_dev_t *dev = nullptr;
-        
-    if(rtlsdr_open(&dev, devId) < 0)
+    Config config(baseConfig);
+    if(configPath && !loadConfig(configPath, config))
     {
-        std::cout << "Failed to open device" << std::endl;
         return -1;
     }
+    std::shared_ptr<const Config> activeConfig = std::make_shared<const Config>(config);
     
     //
-    // Set the frequency
+    // Set up where events go; there is only a broker connection if one of them is MQTT
     //
-    if(rtlsdr_set_center_freq(dev, freq) < 0)
+    if(outputs.empty())
     {
-        std::cout << "Failed to set frequency" << std::endl;
-        return -1;
+        outputs.push_back("mqtt");
     }
     
-    std::cout << "Successfully set the frequency to " << rtlsdr_get_center_freq(dev) << std::endl;
-    
-    //
-    // Set the gain
-    //
-    // For R820T you can set gain to one of the following values:
-    // 0 9 14 27 37 77 87 125 144 157 166 197 207 229 254 280 297 328 338 364 372 386 402 421 434 439 445 480 496
-    if(agc) {
-        if(rtlsdr_set_tuner_gain_mode(dev, 0) < 0)
+    std::unique_ptr<Mqtt> mqtt;
+    std::unique_ptr<Mqtt5> mqtt5;
+    MqttSink *mqttSink = nullptr;
+    MultiSink sinks;
+    for(const std::string &output : outputs)
+    {
+        // Only one broker connection, whichever protocol asked for first
+        if((output == "mqtt" || output == "mqtt5") && mqttSink)
         {
-            std::cout << "Failed to set AGC gain mode" << std::endl;
-            return -1;
+            continue;
         }
-        std::cout << "Successfully set gain to AGC " << std::endl;
-    }
-
-    else {
-        if(rtlsdr_set_tuner_gain_mode(dev, 1) < 0)
+        else if(output == "mqtt")
         {
-            std::cout << "Failed to set gain mode" << std::endl;
-            return -1;
+            mqtt.reset(new Mqtt("sensors345", config.mqttHost.c_str(), config.mqttPort, config.mqttUsername.c_str(), config.mqttPassword.c_str(),
+                (config.baseTopic + "rx_status").c_str(), "FAILED"));
+            mqttSink = new MqttSink(*mqtt, activeConfig);
+            sinks.add(std::unique_ptr<EventSink>(mqttSink));
         }
-        
-        if(rtlsdr_set_tuner_gain(dev, gain) < 0)
+        else if(output == "mqtt5")
+        {
+            mqtt5.reset(new Mqtt5("sensors345", config.mqttHost.c_str(), config.mqttPort, config.mqttUsername.c_str(), config.mqttPassword.c_str(),
+                (config.baseTopic + "rx_status").c_str(), "FAILED"));
+            mqttSink = new MqttSink(*mqtt5, activeConfig);
+            sinks.add(std::unique_ptr<EventSink>(mqttSink));
+        }
+        else if(output.compare(0, 5, "json:") == 0)
+        {
+            std::unique_ptr<JsonSink> sink(new JsonSink());
+            if(!sink->open(output.c_str() + 5))
+            {
+                return -1;
+            }
+            sinks.add(std::move(sink));
+        }
+        else if(output.compare(0, 4, "udp:") == 0)
+        {
+            std::unique_ptr<UdpSink> sink(new UdpSink());
+            if(!sink->open(atoi(output.c_str() + 4)))
+            {
+                return -1;
+            }
+            sinks.add(std::move(sink));
+        }
+        else
         {
-            std::cout << "Failed to set gain" << std::endl;
+            std::cerr << "Unknown output '" << output << "'" << std::endl;
+            usage(argv[0]);
             return -1;
         }
-        std::cout << "Successfully set gain to " << rtlsdr_get_tuner_gain(dev) << std::endl;
-    }
-
-
-    
-    
-    //
-    // Set the sample rate
-    //
-    if(rtlsdr_set_sample_rate(dev, sampleRate) < 0)
-    {
-        std::cout << "Failed to set sample rate" << std::endl;
-        return -1;
     }
     
-    std::cout << "Successfully set the sample rate to " << rtlsdr_get_sample_rate(dev) << std::endl;
+    DigitalDecoder dDecoder(sinks, activeConfig);
+    AnalogDecoder aDecoder(sampleRate);
+    dDecoder.setSampleRate(aDecoder.outputRate());
     
     //
     // Prepare for streaming
     //
-    rtlsdr_reset_buffer(dev);
-    
     for(uint32_t ii = 0; ii < 0x10000; ++ii)
     {
         uint8_t real_i = ii & 0xFF;
@@ -197,17 +372,92 @@ int main(int argc, char ** argv)
     // Common Receive
     //
     
-    aDecoder.setCallback([&](char data){dDecoder.handleData(data);});
+    aDecoder.setCallback([&](char data, float confidence, float level){dDecoder.handleData(data, confidence, level);});
     
     //
-    // Async Receive
+    // Share every frame with local consumers
     //
+    FrameTap frameTap;
+    if(frameTapName)
+    {
+        if(!frameTap.open(frameTapName, FRAME_TAP_SLOTS))
+        {
+            return -1;
+        }
+        dDecoder.setFrameTap(&frameTap);
+    }
     
-    typedef void(*rtlsdr_read_async_cb_t)(unsigned char *buf, uint32_t len, void *ctx);
+    //
+    // Answer queries for the state of every device without going through a broker
+    //
+    SnapshotPublisher snapshotPublisher;
+    SnapshotServer snapshotServer(snapshotPublisher);
+    if(snapshotPath)
+    {
+        if(!snapshotServer.open(snapshotPath))
+        {
+            return -1;
+        }
+        dDecoder.setSnapshotPublisher(&snapshotPublisher);
+    }
+    
+    //
+    // Track the carrier offset off the receive path
+    //
+    FrequencyEstimator freqEstimator(sampleRate, config.frequency, ppm);
+    time_t lastFreqOffsetUpdateTime = 0;
+    freqEstimator.setOffsetCallback([&](float, float crystalPpm)
+    {
+        timeval now;
+        gettimeofday(&now, nullptr);
+
+        if((now.tv_sec - lastFreqOffsetUpdateTime) > FREQ_OFFSET_MIN_SEC)
+        {
+            char value[32];
+            snprintf(value, sizeof(value), "%.1f", crystalPpm);
+            sinks.send(Event("", FREQ_OFFSET_TOPIC, value, 0, true));
+            lastFreqOffsetUpdateTime = now.tv_sec;
+        }
+    });
+    
+    //
+    // Keep the last few seconds of IQ to save when something odd turns up
+    //
+    std::unique_ptr<IqRing> iqRing;
+    if(captureDir)
+    {
+        iqRing.reset(new IqRing(captureDir, sampleRate));
+        dDecoder.setIqRing(iqRing.get());
+    }
+    
+    //
+    // File away every burst for as long as the disk lasts
+    //
+    std::unique_ptr<BurstArchive> burstArchive;
+    if(archiveDir)
+    {
+        burstArchive.reset(new BurstArchive(archiveDir, sampleRate, aDecoder.decimation()));
+        dDecoder.setBurstArchive(burstArchive.get());
+    }
+    
+    //
+    // Watch how regularly buffers arrive, to tell when the receive thread is falling behind
+    //
+    CallbackTiming timing(sampleRate);
+    
+    ReceiveContext ctx = {&aDecoder, &freqEstimator, iqRing.get(), burstArchive.get(), &timing, nullptr};
     
     auto cb = [](unsigned char *buf, uint32_t len, void *ctx)
     {
-        AnalogDecoder *adec = (AnalogDecoder *)ctx;
+        ReceiveContext *rctx = (ReceiveContext *)ctx;
+        AnalogDecoder *adec = rctx->aDecoder;
+        rctx->timing->begin(len);
+        const uint32_t highSamples = adec->highSampleCount();
+        
+        if(rctx->iqRing)
+        {
+            rctx->iqRing->push(buf, len);
+        }
         
         int n_samples = len/2;
         for(int i = 0; i < n_samples; ++i)
@@ -215,48 +465,268 @@ int main(int argc, char ** argv)
             float mag = magLut[*((uint16_t*)(buf + i*2))];
             adec->handleMagnitude(mag);
         }
+        
+        const bool burst = (adec->highSampleCount() - highSamples) >= BURST_MIN_HIGH_SAMPLES;
+        if(burst)
+        {
+            rctx->freqEstimator->handleBuffer(buf, len);
+        }
+        
+        // Once the buffer is decoded, so that the frames found in it go along
+        if(rctx->burstArchive)
+        {
+            rctx->burstArchive->push(buf, len, burst);
+        }
+        
+        if(rctx->autoGain)
+        {
+            const AnalogDecoder::Levels levels = adec->takeLevels();
+            rctx->autoGain->handleLevels(levels.noiseSum, levels.noiseSamples, levels.clippedSamples, levels.samples);
+        }
+        
+        rctx->timing->end();
+    };
+    
+    //
+    // Pick the input: a recording, a burst archive, a dongle served over the network, or a local dongle
+    //
+    std::unique_ptr<InputSource> source;
+    struct stat replayStat;
+    if(replayPath && stat(replayPath, &replayStat) == 0 && S_ISDIR(replayStat.st_mode))
+    {
+        source.reset(new ArchiveSource(replayPath, archiveFromUs, archiveToUs, archiveSerial));
+    }
+    else if(replayPath)
+    {
+        source.reset(new FileSource(replayPath));
+    }
+    else if(rtlTcpAddress)
+    {
+        std::string host(rtlTcpAddress);
+        int port = RTL_TCP_DEFAULT_PORT;
+        const size_t colon = host.rfind(':');
+        if(colon != std::string::npos)
+        {
+            port = atoi(host.c_str() + colon + 1);
+            host.erase(colon);
+        }
+        source.reset(new RtlTcpSource(host.c_str(), port));
+    }
+    else
+    {
+        source.reset(new RtlSdrSource(devId));
+    }
+    
+    if(!source->open())
+    {
+        return -1;
+    }
+    
+    //
+    // Set the frequency, gain and sample rate
+    //
+    if(!source->setFrequency(config.frequency) || !source->setGain(config.agc, config.gain) || !source->setSampleRate(sampleRate))
+    {
+        return -1;
+    }
+    
+    //
+    // Set the frequency correction; after that it follows the measured carrier offset
+    //
+    if(!source->setFreqCorrection(ppm))
+    {
+        return -1;
+    }
+    
+    if(source->isTunable())
+    {
+        freqEstimator.setCorrectionCallback([&](int correction){source->setFreqCorrection(correction);});
+    }
+    
+    //
+    // Pick the gain from what is received, if asked to; the tuner's own AGC takes precedence
+    //
+    std::unique_ptr<AutoGain> autoGain;
+    if(source->isTunable())
+    {
+        autoGain.reset(new AutoGain(*source));
+        autoGain->setReportCallback([&](const AutoGain::Report &report)
+        {
+            char value[32];
+            snprintf(value, sizeof(value), "%.1f", report.gain/10.0f);
+            sinks.send(Event(AUTO_GAIN_DEVICE, "gain", value, 0, true));
+            snprintf(value, sizeof(value), "%.1f", report.noiseDbfs);
+            sinks.send(Event(AUTO_GAIN_DEVICE, "noise_floor", value, 0, true));
+            if(!std::isnan(report.marginDb))
+            {
+                snprintf(value, sizeof(value), "%.1f", report.marginDb);
+                sinks.send(Event(AUTO_GAIN_DEVICE, "margin", value, 0, true));
+            }
+            sinks.send(Event(AUTO_GAIN_DEVICE, "decision", report.decision, 0, true));
+        });
+        ctx.autoGain = autoGain.get();
+        dDecoder.setAutoGain(autoGain.get());
+        autoGain->setEnabled(config.autoGain && !config.agc);
+    }
+    
+    //
+    // Reload the config file on SIGHUP and apply it without stopping reception, and publish the input
+    // statistics in between.  It is woken with a SIGHUP and stopControl set to shut down.
+    //
+    std::atomic<bool> stopControl(false);
+    auto controlLoop = [&]()
+    {
+        const timespec statsInterval = {INPUT_STATS_SEC, 0};
+        InputSource::Stats lastStats = source->stats();
+        
+        while(true)
+        {
+            int signal = sigtimedwait(&hupSignals, nullptr, &statsInterval);
+            if(signal < 0 && errno == EAGAIN)
+            {
+                const InputSource::Stats stats = source->stats();
+                char value[32];
+                
+                snprintf(value, sizeof(value), "%.1f", (stats.bytes - lastStats.bytes)/2.0/INPUT_STATS_SEC/1000.0);
+                sinks.send(Event(INPUT_STATS_DEVICE, "throughput", value, 0, true));
+                snprintf(value, sizeof(value), "%u", stats.gaps);
+                sinks.send(Event(INPUT_STATS_DEVICE, "gaps", value, 0, true));
+                snprintf(value, sizeof(value), "%llu", (unsigned long long)stats.samplesLost);
+                sinks.send(Event(INPUT_STATS_DEVICE, "samples_lost", value, 0, true));
+                
+                if(stats.gaps != lastStats.gaps)
+                {
+                    std::cout << "Input: " << (stats.gaps - lastStats.gaps) << " gaps, "
+                        << (stats.samplesLost - lastStats.samplesLost) << " samples lost in the last " << INPUT_STATS_SEC << "s" << std::endl;
+                }
+                
+                // A recording is read as fast as it decodes, so its timing says nothing
+                const CallbackTiming::Stats callbackStats = timing.take();
+                if(source->isTunable())
+                {
+                    snprintf(value, sizeof(value), "%u", callbackStats.maxJitterUs);
+                    sinks.send(Event(INPUT_STATS_DEVICE, "callback_jitter_us", value, 0, true));
+                    snprintf(value, sizeof(value), "%u", callbackStats.maxRunUs);
+                    sinks.send(Event(INPUT_STATS_DEVICE, "callback_max_us", value, 0, true));
+                    snprintf(value, sizeof(value), "%u", callbackStats.lateBuffers);
+                    sinks.send(Event(INPUT_STATS_DEVICE, "late_buffers", value, 0, true));
+                    
+                    if(callbackStats.lateBuffers || callbackStats.overruns)
+                    {
+                        std::cout << "Receive: " << callbackStats.lateBuffers << " of " << callbackStats.buffers << " buffers late, "
+                            << callbackStats.overruns << " took longer to decode than they last, worst jitter "
+                            << callbackStats.maxJitterUs << "us in the last " << INPUT_STATS_SEC << "s" << std::endl;
+                    }
+                }
+                
+                lastStats = stats;
+                continue;
+            }
+            else if(signal < 0)
+            {
+                continue;
+            }
+            else if(stopControl)
+            {
+                break;
+            }
+            
+            Config reloaded(baseConfig);
+            if(!configPath || !loadConfig(configPath, reloaded))
+            {
+                std::cout << "Keeping the current configuration" << std::endl;
+                continue;
+            }
+            
+            std::shared_ptr<const Config> previous = std::atomic_load(&activeConfig);
+            std::shared_ptr<const Config> next = std::make_shared<const Config>(reloaded);
+            
+            if(mqtt && !next->sameBroker(*previous))
+            {
+                mqtt->reconfigure(next->mqttHost.c_str(), next->mqttPort, next->mqttUsername.c_str(), next->mqttPassword.c_str(),
+                    (next->baseTopic + "rx_status").c_str());
+            }
+            if(mqtt5 && !next->sameBroker(*previous))
+            {
+                mqtt5->reconfigure(next->mqttHost.c_str(), next->mqttPort, next->mqttUsername.c_str(), next->mqttPassword.c_str(),
+                    (next->baseTopic + "rx_status").c_str());
+            }
+            
+            if(next->frequency != previous->frequency)
+            {
+                source->setFrequency(next->frequency);
+                freqEstimator.setCenterFrequency(next->frequency);
+            }
+            
+            if(next->gain != previous->gain || next->agc != previous->agc || next->autoGain != previous->autoGain)
+            {
+                // Turning automatic gain on calibrates again
+                const bool automatic = autoGain && next->autoGain && !next->agc;
+                if(autoGain)
+                {
+                    autoGain->setEnabled(automatic);
+                }
+                if(!automatic)
+                {
+                    source->setGain(next->agc, next->gain);
+                }
+            }
+            
+            std::atomic_store(&activeConfig, next);
+            dDecoder.setConfig(next);
+            if(mqttSink)
+            {
+                mqttSink->setConfig(next);
+            }
+            std::cout << "Reloaded " << configPath << std::endl;
+        }
     };
+    
+    //
+    // Async Receive
+    //
 
     // Setup watchdog to check for a common-mode failure (e.g. antenna disconnection)
-    std::signal(SIGALRM, alarmHandler);
-    alarm(3);
+    if(source->isTunable())
+    {
+        std::signal(SIGALRM, alarmHandler);
+        alarm(3);
+    }
   
-    // Initialize RX state to good
-    dDecoder.setRxGood(true);
-    const int err = rtlsdr_read_async(dev, cb, &aDecoder, 0, 0);
-    std::cout << "Read Async returned " << err << std::endl;
-   
-/*    
+    std::thread controlThread(controlLoop);
+    auto joinControl = [&]()
+    {
+        stopControl = true;
+        pthread_kill(controlThread.native_handle(), SIGHUP);
+        controlThread.join();
+    };
+    
     //
-    // Synchronous Receive
+    // Everything else is running by now, so only the receive path becomes real-time.  Its tables, its
+    // stack and a heap reserve are faulted in and locked first, so that it doesn't wait on the kernel
+    // for memory unless it outgrows them.
     //
-    static const size_t BUF_SIZE = 1024*256;
-    uint8_t buffer[BUF_SIZE];
-    
-    while(true)
+    if(realtime)
     {
-        int n_read = 0;
-        if(rtlsdr_read_sync(dev, buffer, BUF_SIZE, &n_read) < 0)
+        dDecoder.prefault(REALTIME_DEVICE_RESERVE);
+        if(!lockMemory(REALTIME_HEAP_RESERVE) || !makeThreadRealtime(decoderCpu, REALTIME_PRIORITY, "decoder"))
         {
-            std::cout << "Failed to read from device" << std::endl;
+            joinControl();
             return -1;
         }
-        
-        int n_samples = n_read/2;
-        for(int i = 0; i < n_samples; ++i)
-        {
-            float mag = magLut[*((uint16_t*)(buffer + i*2))];
-            aDecoder.handleMagnitude(mag);
-        }
+        source->setIoRealtime(inputCpu, REALTIME_PRIORITY + 1);
     }
-*/    
+    
+    // Initialize RX state to good
+    dDecoder.setRxGood(true);
+    const int err = source->run(cb, &ctx);
+    
     //
-    // Shut down
+    // Shut down, the control thread first as it uses the source and the outputs
     //
-    rtlsdr_close(dev);
-    return 0;
+    dDecoder.flushSnapshot();
+    joinControl();
+    autoGain.reset();
+    source.reset();
+    return err;
 }
-
-
-
-
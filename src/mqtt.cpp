@@ -13,8 +13,8 @@ Mqtt::Mqtt(const char * _id, const char * _host, int _port, const char * _userna
     this->id = _id;
     this->port = _port;
     this->host = _host;
-    this->will_topic = _will_topic;
-    this->will_message = _will_message;
+    this->will_topic = _will_topic ? _will_topic : "";
+    this->will_message = _will_message ? _will_message : "";
     reinitialise(this->id, true);
     // Set version to 3.1.1
     opts_set(MOSQ_OPT_PROTOCOL_VERSION, &version);
@@ -24,8 +24,8 @@ Mqtt::Mqtt(const char * _id, const char * _host, int _port, const char * _userna
         username_pw_set(_username, _password);
     }
     // Set last will and testament (LWT) message
-    if (will_topic != NULL && will_message != NULL) {
-        int rc = set_will(will_topic, will_message);
+    if (_will_topic != NULL && _will_message != NULL) {
+        int rc = set_will(will_topic.c_str(), will_message.c_str());
         if ( rc ) {
             std::cout <<">> Mqtt - set LWT message to: " << will_message << std::endl;
         } else {
@@ -34,12 +34,14 @@ Mqtt::Mqtt(const char * _id, const char * _host, int _port, const char * _userna
     }
 
     // non blocking connection to broker request;
-    connect_async(host, port, keepalive);
+    connect_async(host.c_str(), port, keepalive);
     // Start thread managing connection / publish / subscribekeepalive);
     loop_start();
 };
 
 Mqtt::~Mqtt() {
+    // Without the disconnect the loop thread would never return
+    disconnect();
     loop_stop();
     mosqpp::lib_cleanup();
 }
@@ -50,6 +52,33 @@ bool Mqtt::set_will(const char * _topic, const char * _message)
     return ( ret == MOSQ_ERR_SUCCESS );
 }
 
+void Mqtt::reconfigure(const char * _host, int _port, const char * _username, const char * _password, const char * _will_topic)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::cout << ">> Mqtt - switching to " << _host << ":" << _port << std::endl;
+
+    // The loop thread returns once it sees the client disconnecting, and connect_async replaces the
+    // socket it may be waiting on, so stop it for the switch and start it again for the new broker
+    disconnect();
+    loop_stop();
+
+    this->host = _host;
+    this->port = _port;
+    this->will_topic = _will_topic;
+
+    if (strlen(_username) > 0 && strlen(_password) > 0) {
+        username_pw_set(_username, _password);
+    } else {
+        username_pw_set(NULL, NULL);
+    }
+    if (!will_message.empty()) {
+        set_will(will_topic.c_str(), will_message.c_str());
+    }
+
+    connect_async(host.c_str(), port, keepalive);
+    loop_start();
+}
+
 void Mqtt::on_disconnect(int rc) {
     std::cout << ">> Mqtt - disconnected(" << rc << ")" << std::endl;
 }
@@ -80,6 +109,7 @@ bool Mqtt::send(const char * _topic, const char * _message, int qos, bool retain
     // * retain (boolean) - indicates if message is retained on broker or not
     // Should return MOSQ_ERR_SUCCESS
     std::cout << _topic << "    " << _message << ((qos==0)?"*":"") << std::endl;
+    std::lock_guard<std::mutex> lock(mutex);
     int ret = publish(NULL, _topic, strlen(_message), _message, qos, retain);
     return ( ret == MOSQ_ERR_SUCCESS );
 }
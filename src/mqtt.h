@@ -2,17 +2,21 @@
 #define __MQTT_H__
 
 #include <stdint.h>
+#include <mutex>
+#include <string>
 #include <mosquittopp.h>
 
 class Mqtt : public mosqpp::mosquittopp
 {
     private:
-        const char      *host;
+        std::string     host;
         const char      *id;
         int             port;
         int             keepalive;
-        const char      *will_message;
-        const char      *will_topic;
+        std::string     will_message;
+        std::string     will_topic;
+        // Held while publishing and while switching brokers, so that nothing is published halfway through a switch
+        std::mutex      mutex;
 
         void on_connect(int rc);
         void on_disconnect(int rc);
@@ -23,6 +27,8 @@ class Mqtt : public mosqpp::mosquittopp
         ~Mqtt();
         bool send(const char * _topic, const char * _message, int qos=1, bool retain=true);
         bool set_will(const char * _topic, const char * _message);
+        // Drops the current connection and connects to the given broker instead
+        void reconfigure(const char *_host, int _port, const char *_username, const char *_password, const char *_will_topic);
 };
 
 #endif
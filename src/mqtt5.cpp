@@ -0,0 +1,212 @@
+#include "mqtt5.h"
+
+#include <iostream>
+#include <string.h>
+
+// Bytes a topic alias property takes: its identifier and the 16 bit alias
+#define MQTT5_ALIAS_LEN (3)
+
+Mqtt5::Mqtt5(const char *id, const char *host, int port, const char *username, const char *password, const char *willTopic, const char *willMessage) :
+    m_host(host),
+    m_port(port),
+    m_willTopic(willTopic ? willTopic : ""),
+    m_willMessage(willMessage ? willMessage : "")
+{
+    mosquitto_lib_init();
+    m_mosq = mosquitto_new(id, true, this);
+    mosquitto_int_option(m_mosq, MOSQ_OPT_PROTOCOL_VERSION, MQTT_PROTOCOL_V5);
+    mosquitto_connect_v5_callback_set(m_mosq, onConnect);
+    mosquitto_disconnect_v5_callback_set(m_mosq, onDisconnect);
+
+    if(strlen(username) > 0 && strlen(password) > 0)
+    {
+        std::cerr << "Using credentials: " << username << ":" << password << std::endl;
+        mosquitto_username_pw_set(m_mosq, username, password);
+    }
+
+    if(!m_willTopic.empty() && !m_willMessage.empty())
+    {
+        if(mosquitto_will_set(m_mosq, m_willTopic.c_str(), m_willMessage.size(), m_willMessage.c_str(), 1, true) == MOSQ_ERR_SUCCESS)
+        {
+            std::cout << ">> Mqtt5 - set LWT message to: " << m_willMessage << std::endl;
+        }
+        else
+        {
+            std::cout << ">> Mqtt5 - Failed to set LWT message!" << std::endl;
+        }
+    }
+
+    // Connects, and reconnects, from the loop thread
+    mosquitto_connect_async(m_mosq, m_host.c_str(), m_port, 30);
+    mosquitto_loop_start(m_mosq);
+}
+
+Mqtt5::~Mqtt5()
+{
+    mosquitto_disconnect(m_mosq);
+    mosquitto_loop_stop(m_mosq, false);
+    mosquitto_destroy(m_mosq);
+    mosquitto_lib_cleanup();
+}
+
+void Mqtt5::reconfigure(const char *host, int port, const char *username, const char *password, const char *willTopic)
+{
+    std::lock_guard<std::mutex> switching(m_switchMutex);
+    std::cout << ">> Mqtt5 - switching to " << host << ":" << port << std::endl;
+
+    // Nothing goes out with an alias until the new broker says how many it takes
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_connected = false;
+        resetAliases(0);
+    }
+
+    // The loop thread returns once it sees the client disconnecting, and connecting again replaces the
+    // socket it may be waiting on, so stop it for the switch and start it again for the new broker
+    mosquitto_disconnect(m_mosq);
+    mosquitto_loop_stop(m_mosq, false);
+
+    m_host = host;
+    m_port = port;
+    m_willTopic = willTopic;
+
+    if(strlen(username) > 0 && strlen(password) > 0)
+    {
+        mosquitto_username_pw_set(m_mosq, username, password);
+    }
+    else
+    {
+        mosquitto_username_pw_set(m_mosq, NULL, NULL);
+    }
+    if(!m_willMessage.empty())
+    {
+        mosquitto_will_set(m_mosq, m_willTopic.c_str(), m_willMessage.size(), m_willMessage.c_str(), 1, true);
+    }
+
+    mosquitto_connect_async(m_mosq, m_host.c_str(), m_port, 30);
+    mosquitto_loop_start(m_mosq);
+}
+
+void Mqtt5::onConnect(struct mosquitto *, void *obj, int rc, int, const mosquitto_property *props)
+{
+    Mqtt5 *mqtt = (Mqtt5 *)obj;
+    if(rc != 0)
+    {
+        std::cout << ">> Mqtt5 - failed to connect: (" << rc << ")" << std::endl;
+        return;
+    }
+
+    // A broker that doesn't say how many aliases it takes doesn't take any
+    uint16_t aliasMax = 0;
+    mosquitto_property_read_int16(props, MQTT_PROP_TOPIC_ALIAS_MAXIMUM, &aliasMax, false);
+
+    std::lock_guard<std::mutex> lock(mqtt->m_mutex);
+    mqtt->m_connected = true;
+    mqtt->resetAliases(aliasMax);
+    std::cout << ">> Mqtt5 - connected, " << aliasMax << " topic aliases" << std::endl;
+}
+
+void Mqtt5::onDisconnect(struct mosquitto *, void *obj, int rc, const mosquitto_property *)
+{
+    Mqtt5 *mqtt = (Mqtt5 *)obj;
+    std::cout << ">> Mqtt5 - disconnected(" << rc << ")" << std::endl;
+
+    std::lock_guard<std::mutex> lock(mqtt->m_mutex);
+    mqtt->m_connected = false;
+    mqtt->resetAliases(0);
+}
+
+void Mqtt5::resetAliases(uint16_t aliasMax)
+{
+    m_aliasMax = aliasMax;
+    m_nextAlias = 1;
+    m_aliasSavings = 0;
+    m_aliases.clear();
+    m_recentTopics.clear();
+    m_freeAliases.clear();
+}
+
+bool Mqtt5::send(const char *topic, const char *message, int qos, bool retain, uint32_t expirySec, const Properties &properties)
+{
+    std::cout << topic << "    " << message << ((qos==0)?"*":"") << std::endl;
+
+    mosquitto_property *props = NULL;
+    if(expirySec)
+    {
+        mosquitto_property_add_int32(&props, MQTT_PROP_MESSAGE_EXPIRY_INTERVAL, expirySec);
+    }
+    for(const auto &property : properties)
+    {
+        mosquitto_property_add_string_pair(&props, MQTT_PROP_USER_PROPERTY, property.first.c_str(), property.second.c_str());
+    }
+
+    std::lock_guard<std::mutex> switching(m_switchMutex);
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    //
+    // The first message on a topic carries both the topic and its new alias; after that the alias
+    // alone will do.  Once they are all taken, the least recently used one is bound to the new topic.
+    //
+    // A binding costs a few bytes that only the next message on the topic wins back.  When topics keep
+    // pushing each other out before that, no new bindings are made until the ones that do get used
+    // have saved more than was spent, so aliases never cost more than aliasMax bindings' worth.
+    //
+    const char *sentTopic = topic;
+    bool aliasUsed = false;
+    uint16_t newAlias = 0;
+    if(qos == 0 && m_connected && m_aliasMax)
+    {
+        auto alias = m_aliases.find(topic);
+        if(alias != m_aliases.end())
+        {
+            m_recentTopics.splice(m_recentTopics.begin(), m_recentTopics, alias->second.recent);
+            mosquitto_property_add_int16(&props, MQTT_PROP_TOPIC_ALIAS, alias->second.alias);
+            sentTopic = "";
+            aliasUsed = true;
+        }
+        else if(m_aliasSavings > -(int64_t)MQTT5_ALIAS_LEN*m_aliasMax)
+        {
+            if(!m_freeAliases.empty())
+            {
+                newAlias = m_freeAliases.back();
+                m_freeAliases.pop_back();
+            }
+            else if(m_nextAlias <= m_aliasMax)
+            {
+                newAlias = m_nextAlias++;
+            }
+            else
+            {
+                auto leastRecent = m_aliases.find(m_recentTopics.back());
+                newAlias = leastRecent->second.alias;
+                m_aliases.erase(leastRecent);
+                m_recentTopics.pop_back();
+            }
+
+            m_recentTopics.push_front(topic);
+            m_aliases[topic] = {newAlias, m_recentTopics.begin()};
+            mosquitto_property_add_int16(&props, MQTT_PROP_TOPIC_ALIAS, newAlias);
+        }
+    }
+
+    const int ret = mosquitto_publish_v5(m_mosq, NULL, sentTopic, strlen(message), message, qos, retain, props);
+    mosquitto_property_free_all(&props);
+
+    // The broker never heard of an alias that didn't make it out; it goes to the next new topic instead
+    if(newAlias && ret != MOSQ_ERR_SUCCESS)
+    {
+        auto alias = m_aliases.find(topic);
+        m_recentTopics.erase(alias->second.recent);
+        m_aliases.erase(alias);
+        m_freeAliases.push_back(newAlias);
+    }
+    else if(newAlias)
+    {
+        m_aliasSavings -= MQTT5_ALIAS_LEN;
+    }
+    else if(aliasUsed && ret == MOSQ_ERR_SUCCESS)
+    {
+        m_aliasSavings += (int64_t)strlen(topic) - MQTT5_ALIAS_LEN;
+    }
+    return ( ret == MOSQ_ERR_SUCCESS );
+}
@@ -0,0 +1,76 @@
+#ifndef __MQTT5_H__
+#define __MQTT5_H__
+
+#include <stdint.h>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <mosquitto.h>
+
+//
+// The same broker connection as Mqtt, but speaking MQTT 5 through the libmosquitto C API, which
+// mosquittopp doesn't expose.  On top of plain publishing it:
+//
+//  - replaces the topic of QoS 0 messages with a topic alias after the first one.  With more topics
+//    than the broker allows aliases for (10 by default on mosquitto), the alias of the least recently
+//    published topic is bound to the new one, by sending the topic with that alias once more.  Topics
+//    that would only push each other out stop getting aliases, so that aliases never cost more than
+//    they save by more than one binding per alias.  Messages with QoS 1 or 2 always carry their
+//    topic, since libmosquitto resends them as they are after a reconnect, when the broker has
+//    forgotten every alias.
+//  - sets a message expiry interval, so that brokers don't keep stale messages for offline clients
+//  - attaches user properties
+//
+class Mqtt5
+{
+  public:
+    typedef std::vector<std::pair<std::string, std::string>> Properties;
+
+    Mqtt5(const char *id, const char *host, int port, const char *username, const char *password, const char *willTopic, const char *willMessage);
+    ~Mqtt5();
+
+    // expirySec of 0 means the message never expires
+    bool send(const char *topic, const char *message, int qos, bool retain, uint32_t expirySec, const Properties &properties);
+
+    // Drops the current connection and connects to the given broker instead
+    void reconfigure(const char *host, int port, const char *username, const char *password, const char *willTopic);
+
+  private:
+    static void onConnect(struct mosquitto *mosq, void *obj, int rc, int flags, const mosquitto_property *props);
+    static void onDisconnect(struct mosquitto *mosq, void *obj, int rc, const mosquitto_property *props);
+
+    // Forgets every alias, for a new connection that allows aliasMax of them; with m_mutex held
+    void resetAliases(uint16_t aliasMax);
+
+    struct mosquitto *m_mosq;
+    std::string m_host;
+    int m_port;
+    std::string m_willTopic;
+    std::string m_willMessage;
+
+    struct Alias
+    {
+        uint16_t alias;
+        std::list<std::string>::iterator recent;
+    };
+
+    // Held while publishing and while switching brokers, so that nothing is published halfway through
+    // a switch.  The loop thread never takes it, so a switch can wait for that thread to stop.
+    std::mutex m_switchMutex;
+
+    // Guards the aliases, which only hold for one connection; also held while publishing, so that a
+    // message can't go out with an alias on a connection that doesn't know it
+    std::mutex m_mutex;
+    bool m_connected = false;
+    uint16_t m_aliasMax = 0;
+    uint16_t m_nextAlias = 1;
+    std::unordered_map<std::string, Alias> m_aliases;
+    std::list<std::string> m_recentTopics;      // Most recently published first
+    std::vector<uint16_t> m_freeAliases;        // Given up on after a failed publish
+    int64_t m_aliasSavings = 0;                 // Bytes saved by aliases, less those spent binding them
+};
+
+#endif
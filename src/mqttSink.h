@@ -0,0 +1,44 @@
+#ifndef __MQTT_SINK_H__
+#define __MQTT_SINK_H__
+
+#include "eventSink.h"
+#include "mqtt.h"
+#include "mqtt5.h"
+#include "config.h"
+
+#include <memory>
+
+//
+// Publishes each event under the configured base topic, over MQTT 3.1.1 or 5.  With 5, the event's
+// expiry and properties go along.
+//
+class MqttSink : public EventSink
+{
+  public:
+    MqttSink(Mqtt &mqtt_init, std::shared_ptr<const Config> config_init) : mqtt(&mqtt_init), config(config_init) {}
+    MqttSink(Mqtt5 &mqtt5_init, std::shared_ptr<const Config> config_init) : mqtt5(&mqtt5_init), config(config_init) {}
+
+    // May be called from any thread
+    void setConfig(std::shared_ptr<const Config> newConfig) {std::atomic_store(&config, newConfig);};
+
+    void send(const Event &event) override
+    {
+        auto config = std::atomic_load(&this->config);
+        const std::string topic = config->baseTopic + event.topic();
+        if(mqtt5)
+        {
+            mqtt5->send(topic.c_str(), event.value.c_str(), event.qos, event.retain, event.expirySec, event.properties);
+        }
+        else
+        {
+            mqtt->send(topic.c_str(), event.value.c_str(), event.qos, event.retain);
+        }
+    };
+
+  private:
+    Mqtt *mqtt = nullptr;
+    Mqtt5 *mqtt5 = nullptr;
+    std::shared_ptr<const Config> config;
+};
+
+#endif
@@ -0,0 +1,141 @@
+#include "realtime.h"
+
+#include <iostream>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+// Stack the receive thread may use without faulting in a new page
+#define REALTIME_STACK_PREFAULT (512*1024)
+
+static uint64_t monotonicUs()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec*1000000 + now.tv_nsec/1000;
+}
+
+/* Raises a max kept for another thread to take(); losing a race with it only loses one sample */
+static void raiseMax(std::atomic<uint32_t> &max, uint32_t value)
+{
+    if(value > max.load(std::memory_order_relaxed))
+    {
+        max.store(value, std::memory_order_relaxed);
+    }
+}
+
+bool makeThreadRealtime(int cpu, int priority, const char *name)
+{
+    if(cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+
+        const int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if(err != 0)
+        {
+            std::cout << "Failed to pin the " << name << " thread to CPU " << cpu << ": " << strerror(err) << std::endl;
+            return false;
+        }
+    }
+
+    sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+
+    const int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if(err != 0)
+    {
+        std::cout << "Failed to make the " << name << " thread real-time: " << strerror(err) << std::endl;
+        return false;
+    }
+
+    std::cout << "Running the " << name << " thread at SCHED_FIFO priority " << priority;
+    if(cpu >= 0)
+    {
+        std::cout << " on CPU " << cpu;
+    }
+    std::cout << std::endl;
+    return true;
+}
+
+bool lockMemory(size_t heapReserve)
+{
+    // Freed memory stays with the process, and large blocks come from the heap rather than their own
+    // mappings, so the reserve stays in the heap to be reused
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+
+    if(heapReserve)
+    {
+        unsigned char *reserve = (unsigned char *)malloc(heapReserve);
+        if(reserve)
+        {
+            memset(reserve, 0, heapReserve);
+        }
+        free(reserve);
+    }
+
+    volatile unsigned char stack[REALTIME_STACK_PREFAULT];
+    for(size_t ii = 0; ii < sizeof(stack); ii += 4096)
+    {
+        stack[ii] = 0;
+    }
+
+    if(mlockall(MCL_CURRENT) < 0)
+    {
+        std::cout << "Failed to lock memory: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+void CallbackTiming::begin(uint32_t len)
+{
+    const uint64_t now = monotonicUs();
+
+    //
+    // The previous buffer should have been followed by this one after as long as it lasted
+    //
+    if(m_lastBeginUs != 0)
+    {
+        const int64_t lateUs = (int64_t)(now - m_lastBeginUs) - (int64_t)m_durationUs;
+        raiseMax(m_maxJitterUs, (uint32_t)std::abs(lateUs));
+        if(lateUs > (int64_t)m_durationUs)
+        {
+            m_lateBuffers.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    m_lastBeginUs = now;
+    m_durationUs = (uint64_t)len/2*1000000/m_sampleRate;
+    m_buffers.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CallbackTiming::end()
+{
+    const uint64_t runUs = monotonicUs() - m_lastBeginUs;
+    raiseMax(m_maxRunUs, (uint32_t)runUs);
+    if(runUs > m_durationUs)
+    {
+        m_overruns.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+CallbackTiming::Stats CallbackTiming::take()
+{
+    Stats stats;
+    stats.buffers = m_buffers.exchange(0);
+    stats.lateBuffers = m_lateBuffers.exchange(0);
+    stats.overruns = m_overruns.exchange(0);
+    stats.maxJitterUs = m_maxJitterUs.exchange(0);
+    stats.maxRunUs = m_maxRunUs.exchange(0);
+    return stats;
+}
@@ -0,0 +1,71 @@
+#ifndef __REALTIME_H__
+#define __REALTIME_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// SCHED_FIFO priority of the decoding thread.  A thread of the input's own that reads from the receiver
+// runs one above it, so that it is never held up by the decoding.
+#ifndef REALTIME_PRIORITY
+#define REALTIME_PRIORITY (50)
+#endif
+
+//
+// Opt-in real-time scheduling for the receive path.  On a busy machine an ordinary thread can be
+// descheduled for long enough that librtlsdr runs out of transfers and drops samples; a SCHED_FIFO
+// thread pinned to its own core isn't, and with its stack and heap locked it doesn't wait on page
+// faults for them either.  The decoder still allocates for events and snapshots while receiving, but
+// out of the locked heap, so malloc only goes to the kernel once the reserve is used up.
+//
+
+// Pins the calling thread to cpu, unless it is negative, and runs it as SCHED_FIFO at priority.  Threads
+// it starts afterwards inherit both.
+bool makeThreadRealtime(int cpu, int priority, const char *name);
+
+// Locks all memory mapped so far into RAM and stops malloc from handing memory back to the kernel.
+// Before that it grows the calling thread's heap by heapReserve and faults in enough of its stack that
+// neither has to grow while receiving.  Threads started afterwards aren't locked, and with them the
+// whole of their stacks, so call it once every other thread is running.
+bool lockMemory(size_t heapReserve);
+
+//
+// How regularly the receive callback gets called and how long it takes.  Buffers should arrive one
+// buffer's duration apart; when one comes much later than that the receiver has likely dropped samples.
+//
+class CallbackTiming
+{
+  public:
+    struct Stats
+    {
+        uint32_t buffers;
+        uint32_t lateBuffers;       // Arrived more than a buffer's duration later than due
+        uint32_t overruns;          // Took longer to decode than the buffer lasts
+        uint32_t maxJitterUs;       // Furthest a buffer arrived from when it was due
+        uint32_t maxRunUs;          // Longest time spent in the callback
+    };
+
+    CallbackTiming(uint32_t sampleRate) : m_sampleRate(sampleRate) {}
+
+    // From the receive callback, on the way in and on the way out
+    void begin(uint32_t len);
+    void end();
+
+    // Returns the stats since the last call and starts over; may be called from any thread
+    Stats take();
+
+  private:
+    const uint32_t m_sampleRate;
+
+    // Only touched by the receive callback
+    uint64_t m_lastBeginUs = 0;
+    uint64_t m_durationUs = 0;
+
+    std::atomic<uint32_t> m_buffers{0};
+    std::atomic<uint32_t> m_lateBuffers{0};
+    std::atomic<uint32_t> m_overruns{0};
+    std::atomic<uint32_t> m_maxJitterUs{0};
+    std::atomic<uint32_t> m_maxRunUs{0};
+};
+
+#endif
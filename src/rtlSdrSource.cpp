@@ -0,0 +1,146 @@
+#include "rtlSdrSource.h"
+
+#include <iostream>
+
+RtlSdrSource::~RtlSdrSource()
+{
+    if(m_dev)
+    {
+        rtlsdr_close(m_dev);
+    }
+}
+
+bool RtlSdrSource::open()
+{
+    if(rtlsdr_get_device_count() < 1)
+    {
+        std::cout << "Could not find any devices" << std::endl;
+        return false;
+    }
+
+    if(rtlsdr_open(&m_dev, m_devId) < 0)
+    {
+        std::cout << "Failed to open device" << std::endl;
+        m_dev = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
+bool RtlSdrSource::setFrequency(uint32_t freq)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(rtlsdr_set_center_freq(m_dev, freq) < 0)
+    {
+        std::cout << "Failed to set frequency" << std::endl;
+        return false;
+    }
+
+    std::cout << "Successfully set the frequency to " << rtlsdr_get_center_freq(m_dev) << std::endl;
+    return true;
+}
+
+bool RtlSdrSource::setSampleRate(uint32_t rate)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(rtlsdr_set_sample_rate(m_dev, rate) < 0)
+    {
+        std::cout << "Failed to set sample rate" << std::endl;
+        return false;
+    }
+
+    std::cout << "Successfully set the sample rate to " << rtlsdr_get_sample_rate(m_dev) << std::endl;
+    return true;
+}
+
+bool RtlSdrSource::setGain(int agc, int gain)
+{
+    // For R820T you can set gain to one of the following values:
+    // 0 9 14 27 37 77 87 125 144 157 166 197 207 229 254 280 297 328 338 364 372 386 402 421 434 439 445 480 496
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(agc) {
+        if(rtlsdr_set_tuner_gain_mode(m_dev, 0) < 0)
+        {
+            std::cout << "Failed to set AGC gain mode" << std::endl;
+            return false;
+        }
+        std::cout << "Successfully set gain to AGC " << std::endl;
+    }
+
+    else {
+        if(rtlsdr_set_tuner_gain_mode(m_dev, 1) < 0)
+        {
+            std::cout << "Failed to set gain mode" << std::endl;
+            return false;
+        }
+
+        if(rtlsdr_set_tuner_gain(m_dev, gain) < 0)
+        {
+            std::cout << "Failed to set gain" << std::endl;
+            return false;
+        }
+        std::cout << "Successfully set gain to " << rtlsdr_get_tuner_gain(m_dev) << std::endl;
+    }
+
+    return true;
+}
+
+std::vector<int> RtlSdrSource::tunerGains()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const int count = rtlsdr_get_tuner_gains(m_dev, nullptr);
+    if(count <= 0)
+    {
+        return {};
+    }
+
+    std::vector<int> gains(count);
+    rtlsdr_get_tuner_gains(m_dev, gains.data());
+    return gains;
+}
+
+bool RtlSdrSource::setFreqCorrection(int ppm)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // librtlsdr refuses to "change" the correction to the value it already has
+    if(ppm == rtlsdr_get_freq_correction(m_dev))
+    {
+        return true;
+    }
+
+    if(rtlsdr_set_freq_correction(m_dev, ppm) < 0)
+    {
+        std::cout << "Failed to set frequency correction" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+int RtlSdrSource::run(Callback cb, void *ctx)
+{
+    m_cb = cb;
+    m_ctx = ctx;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        rtlsdr_reset_buffer(m_dev);
+    }
+    const int err = rtlsdr_read_async(m_dev, receive, this, 0, 0);
+    std::cout << "Read Async returned " << err << std::endl;
+    return err;
+}
+
+void RtlSdrSource::stop()
+{
+    rtlsdr_cancel_async(m_dev);
+}
+
+void RtlSdrSource::receive(unsigned char *buf, uint32_t len, void *ctx)
+{
+    RtlSdrSource *source = (RtlSdrSource *)ctx;
+    source->countBytes(len);
+    source->m_cb(buf, len, source->m_ctx);
+}
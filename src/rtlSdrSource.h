@@ -0,0 +1,42 @@
+#ifndef __RTL_SDR_SOURCE_H__
+#define __RTL_SDR_SOURCE_H__
+
+#include "inputSource.h"
+
+#include <mutex>
+#include <rtl-sdr.h>
+
+//
+// A dongle on this machine, through librtlsdr.  USB transfers are handled on the thread that calls
+// run(), the same one the callback decodes on.
+//
+class RtlSdrSource : public InputSource
+{
+  public:
+    RtlSdrSource(int devId) : m_devId(devId) {};
+    ~RtlSdrSource();
+
+    bool open() override;
+    bool setFrequency(uint32_t freq) override;
+    bool setSampleRate(uint32_t rate) override;
+    bool setGain(int agc, int gain) override;
+    bool setFreqCorrection(int ppm) override;
+    std::vector<int> tunerGains() override;
+
+    int run(Callback cb, void *ctx) override;
+    void stop() override;
+
+  private:
+    static void receive(unsigned char *buf, uint32_t len, void *ctx);
+
+    const int m_devId;
+    rtlsdr_dev_t *m_dev = nullptr;
+
+    // Held around every control call, since the control thread, automatic gain and frequency tracking
+    // each change settings, and librtlsdr doesn't serialise its register writes
+    std::mutex m_mutex;
+    Callback m_cb = nullptr;
+    void *m_ctx = nullptr;
+};
+
+#endif
@@ -0,0 +1,418 @@
+#include "rtlTcpSource.h"
+#include "realtime.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// Blocks handed to the callback; the same size as the transfers librtlsdr delivers by default
+#define RTL_TCP_BLOCK_LEN (16*32*512)
+
+// About 4 seconds at 1MS/s
+#define RTL_TCP_BUFFER_LEN (32*RTL_TCP_BLOCK_LEN)
+
+#define RTL_TCP_READ_LEN (64*1024)
+
+// A server that connects but sends nothing for this long is treated as gone
+#define RTL_TCP_TIMEOUT_SEC 5
+
+#define RTL_TCP_MIN_BACKOFF_MS 1000
+#define RTL_TCP_MAX_BACKOFF_MS 30000
+
+// rtl_tcp commands: one command byte followed by a big endian parameter
+#define RTL_TCP_SET_FREQ            0x01
+#define RTL_TCP_SET_SAMPLE_RATE     0x02
+#define RTL_TCP_SET_GAIN_MODE       0x03
+#define RTL_TCP_SET_GAIN            0x04
+#define RTL_TCP_SET_FREQ_CORRECTION 0x05
+
+// Tuner types in the server's header, as librtlsdr numbers them
+#define RTL_TCP_TUNER_E4000  1
+#define RTL_TCP_TUNER_FC0012 2
+#define RTL_TCP_TUNER_FC0013 3
+#define RTL_TCP_TUNER_R820T  5
+#define RTL_TCP_TUNER_R828D  6
+
+RtlTcpSource::RtlTcpSource(const char *host, int port) :
+    m_host(host),
+    m_port(port)
+{
+}
+
+bool RtlTcpSource::open()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_ring.assign(RTL_TCP_BUFFER_LEN, 0);
+    m_ringStart = 0;
+    m_ringFill = 0;
+
+    // Connecting happens in the background once streaming starts, so a server that isn't up yet is
+    // simply retried
+    std::cout << "Streaming from rtl_tcp at " << m_host << ":" << m_port << std::endl;
+    return true;
+}
+
+bool RtlTcpSource::setFrequency(uint32_t freq)
+{
+    std::lock_guard<std::mutex> sendLock(m_sendMutex);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_frequency = freq;
+    }
+    if(m_fd >= 0)
+    {
+        if(!sendCommand(m_fd, RTL_TCP_SET_FREQ, freq))
+        {
+            std::cout << "Failed to set frequency" << std::endl;
+            return false;
+        }
+        std::cout << "Successfully set the frequency to " << freq << std::endl;
+    }
+    return true;
+}
+
+bool RtlTcpSource::setSampleRate(uint32_t rate)
+{
+    std::lock_guard<std::mutex> sendLock(m_sendMutex);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_sampleRate = rate;
+    }
+    if(m_fd >= 0)
+    {
+        if(!sendCommand(m_fd, RTL_TCP_SET_SAMPLE_RATE, rate))
+        {
+            std::cout << "Failed to set sample rate" << std::endl;
+            return false;
+        }
+        std::cout << "Successfully set the sample rate to " << rate << std::endl;
+    }
+    return true;
+}
+
+bool RtlTcpSource::setGain(int agc, int gain)
+{
+    std::lock_guard<std::mutex> sendLock(m_sendMutex);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_agc = agc;
+        m_gain = gain;
+    }
+    if(m_fd >= 0)
+    {
+        if(!sendCommand(m_fd, RTL_TCP_SET_GAIN_MODE, agc ? 0 : 1) || (!agc && !sendCommand(m_fd, RTL_TCP_SET_GAIN, gain)))
+        {
+            std::cout << "Failed to set gain" << std::endl;
+            return false;
+        }
+        std::cout << "Successfully set gain to " << (agc ? "AGC" : std::to_string(gain)) << std::endl;
+    }
+    return true;
+}
+
+/* The server only says which tuner it has, so the gains come from the same tables librtlsdr uses */
+std::vector<int> RtlTcpSource::tunerGains()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    switch(m_tunerType)
+    {
+        case RTL_TCP_TUNER_E4000:
+            return {-10, 15, 40, 65, 90, 115, 140, 165, 190, 215, 240, 290, 340, 420};
+        case RTL_TCP_TUNER_FC0012:
+            return {-99, -40, 71, 179, 192};
+        case RTL_TCP_TUNER_FC0013:
+            return {-99, -73, -65, -63, -60, -58, -54, 58, 61, 63, 65, 67, 68, 70, 71, 179, 181, 182, 184, 186,
+                188, 191, 197};
+        case RTL_TCP_TUNER_R820T:
+        case RTL_TCP_TUNER_R828D:
+            return {0, 9, 14, 27, 37, 77, 87, 125, 144, 157, 166, 197, 207, 229, 254, 280, 297, 328, 338, 364,
+                372, 386, 402, 421, 434, 439, 445, 480, 496};
+        default:
+            return {};
+    }
+}
+
+bool RtlTcpSource::setFreqCorrection(int ppm)
+{
+    std::lock_guard<std::mutex> sendLock(m_sendMutex);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_ppm = ppm;
+    }
+    if(m_fd >= 0 && !sendCommand(m_fd, RTL_TCP_SET_FREQ_CORRECTION, (uint32_t)ppm))
+    {
+        std::cout << "Failed to set frequency correction" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int RtlTcpSource::run(Callback cb, void *ctx)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_running = true;
+    std::thread reader(&RtlTcpSource::readLoop, this);
+
+    std::vector<unsigned char> block(RTL_TCP_BLOCK_LEN);
+    while(true)
+    {
+        m_cond.wait(lock, [this]{return !m_running || m_ringFill >= RTL_TCP_BLOCK_LEN;});
+        if(!m_running)
+        {
+            break;
+        }
+
+        const size_t first = std::min<size_t>(RTL_TCP_BLOCK_LEN, m_ring.size() - m_ringStart);
+        memcpy(block.data(), m_ring.data() + m_ringStart, first);
+        memcpy(block.data() + first, m_ring.data(), RTL_TCP_BLOCK_LEN - first);
+        m_ringStart = (m_ringStart + RTL_TCP_BLOCK_LEN) % m_ring.size();
+        m_ringFill -= RTL_TCP_BLOCK_LEN;
+        lock.unlock();
+
+        countBytes(RTL_TCP_BLOCK_LEN);
+        cb(block.data(), RTL_TCP_BLOCK_LEN, ctx);
+
+        lock.lock();
+    }
+
+    lock.unlock();
+    reader.join();
+    return 0;
+}
+
+void RtlTcpSource::stop()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_running = false;
+    if(m_fd >= 0)
+    {
+        shutdown(m_fd, SHUT_RDWR);
+    }
+    m_cond.notify_all();
+}
+
+void RtlTcpSource::readLoop()
+{
+    // Started after memory was locked, so it locks its own stack; it allocates nothing while reading
+    if(m_ioPriority)
+    {
+        makeThreadRealtime(m_ioCpu, m_ioPriority, "rtl_tcp reader");
+        lockMemory(0);
+    }
+
+    std::vector<unsigned char> chunk(RTL_TCP_READ_LEN);
+    int backoffMs = RTL_TCP_MIN_BACKOFF_MS;
+    bool wasConnected = false;
+    std::chrono::steady_clock::time_point disconnectTime;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(m_running)
+    {
+        lock.unlock();
+        const int fd = connectToServer();
+        std::unique_lock<std::mutex> sendLock(m_sendMutex);
+        lock.lock();
+
+        if(fd < 0)
+        {
+            sendLock.unlock();
+            std::cout << "Retrying rtl_tcp in " << backoffMs/1000 << "s" << std::endl;
+            m_cond.wait_for(lock, std::chrono::milliseconds(backoffMs), [this]{return !m_running;});
+            backoffMs = std::min(2*backoffMs, RTL_TCP_MAX_BACKOFF_MS);
+            continue;
+        }
+
+        // Stopped while connecting
+        if(!m_running)
+        {
+            close(fd);
+            break;
+        }
+
+        m_fd = fd;
+        backoffMs = RTL_TCP_MIN_BACKOFF_MS;
+        if(wasConnected)
+        {
+            const std::chrono::duration<double> gap = std::chrono::steady_clock::now() - disconnectTime;
+            countReconnect();
+            countGap((uint64_t)(gap.count()*m_sampleRate));
+            std::cout << "Reconnected to rtl_tcp after " << gap.count() << "s" << std::endl;
+        }
+        wasConnected = true;
+        lock.unlock();
+
+        // Settings changed from now on are sent as they are set, after these
+        if(!sendSettings(fd))
+        {
+            std::cout << "Failed to send settings to rtl_tcp" << std::endl;
+        }
+        sendLock.unlock();
+
+        while(true)
+        {
+            const ssize_t n_read = recv(fd, chunk.data(), chunk.size(), 0);
+            if(n_read <= 0)
+            {
+                std::cout << "Lost connection to rtl_tcp: " << (n_read == 0 ? "closed by server" : strerror(errno)) << std::endl;
+                break;
+            }
+
+            lock.lock();
+            push(chunk.data(), n_read);
+            lock.unlock();
+            m_cond.notify_all();
+        }
+
+        // Not while a command is being sent on it
+        sendLock.lock();
+        lock.lock();
+        m_fd = -1;
+        close(fd);
+        sendLock.unlock();
+        disconnectTime = std::chrono::steady_clock::now();
+
+        // A sample split across the disconnect would swap I and Q for the rest of the stream
+        m_ringFill &= ~(size_t)1;
+    }
+}
+
+int RtlTcpSource::connectToServer()
+{
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo *addrs = nullptr;
+    const int err = getaddrinfo(m_host.c_str(), std::to_string(m_port).c_str(), &hints, &addrs);
+    if(err != 0)
+    {
+        std::cout << "Failed to resolve " << m_host << ": " << gai_strerror(err) << std::endl;
+        return -1;
+    }
+
+    int fd = -1;
+    for(addrinfo *addr = addrs; addr; addr = addr->ai_next)
+    {
+        fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+        if(fd < 0)
+        {
+            continue;
+        }
+
+        // Also bounds how long connect() can take
+        timeval timeout = {RTL_TCP_TIMEOUT_SEC, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        // Commands are tiny and should go out right away
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        if(connect(fd, addr->ai_addr, addr->ai_addrlen) == 0)
+        {
+            break;
+        }
+
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addrs);
+
+    if(fd < 0)
+    {
+        std::cout << "Failed to connect to rtl_tcp at " << m_host << ":" << m_port << ": " << strerror(errno) << std::endl;
+        return -1;
+    }
+
+    //
+    // The server starts with "RTL0", the tuner type and the number of gain steps
+    //
+    unsigned char header[12];
+    if(recv(fd, header, sizeof(header), MSG_WAITALL) != sizeof(header) || memcmp(header, "RTL0", 4) != 0)
+    {
+        std::cout << "No rtl_tcp server at " << m_host << ":" << m_port << std::endl;
+        close(fd);
+        return -1;
+    }
+
+    const uint32_t tunerType = (header[4] << 24) | (header[5] << 16) | (header[6] << 8) | header[7];
+    std::cout << "Connected to rtl_tcp at " << m_host << ":" << m_port << ", tuner type " << tunerType << std::endl;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tunerType = tunerType;
+    }
+
+    return fd;
+}
+
+bool RtlTcpSource::sendCommand(int fd, uint8_t cmd, uint32_t param)
+{
+    const unsigned char command[5] = {cmd, (unsigned char)(param >> 24), (unsigned char)(param >> 16),
+        (unsigned char)(param >> 8), (unsigned char)param};
+    return send(fd, command, sizeof(command), MSG_NOSIGNAL) == sizeof(command);
+}
+
+bool RtlTcpSource::sendSettings(int fd)
+{
+    bool ok = true;
+    if(m_sampleRate)
+    {
+        ok = sendCommand(fd, RTL_TCP_SET_SAMPLE_RATE, m_sampleRate) && ok;
+    }
+    if(m_frequency)
+    {
+        ok = sendCommand(fd, RTL_TCP_SET_FREQ, m_frequency) && ok;
+    }
+    ok = sendCommand(fd, RTL_TCP_SET_FREQ_CORRECTION, (uint32_t)m_ppm) && ok;
+    ok = sendCommand(fd, RTL_TCP_SET_GAIN_MODE, m_agc ? 0 : 1) && ok;
+    if(!m_agc)
+    {
+        ok = sendCommand(fd, RTL_TCP_SET_GAIN, m_gain) && ok;
+    }
+    return ok;
+}
+
+void RtlTcpSource::push(const unsigned char *data, size_t len)
+{
+    //
+    // The decoder has fallen this far behind; drop the oldest samples rather than stall the socket.
+    // Whole samples only, so I and Q stay in place.  However many chunks it takes the decoder to
+    // catch up, that is one gap.
+    //
+    const size_t space = m_ring.size() - m_ringFill;
+    if(len > space)
+    {
+        const size_t dropped = std::min(m_ringFill, (len - space + 1) & ~(size_t)1);
+        m_ringStart = (m_ringStart + dropped) % m_ring.size();
+        m_ringFill -= dropped;
+        if(m_overflowing)
+        {
+            countLost(dropped/2);
+        }
+        else
+        {
+            countGap(dropped/2);
+            m_overflowing = true;
+        }
+    }
+    else
+    {
+        m_overflowing = false;
+    }
+
+    const size_t end = (m_ringStart + m_ringFill) % m_ring.size();
+    const size_t first = std::min(len, m_ring.size() - end);
+    memcpy(m_ring.data() + end, data, first);
+    memcpy(m_ring.data(), data + first, len - first);
+    m_ringFill += len;
+}
@@ -0,0 +1,72 @@
+#ifndef __RTL_TCP_SOURCE_H__
+#define __RTL_TCP_SOURCE_H__
+
+#include "inputSource.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define RTL_TCP_DEFAULT_PORT 1234
+
+//
+// A dongle on another machine, served by rtl_tcp.
+//
+// A reader thread pulls the stream off the socket into a ring buffer, and run() hands fixed-size
+// blocks from it to the callback.  The ring soaks up both network jitter and the odd slow decode, so
+// the socket keeps draining and the server never has to drop samples on our account.  When the
+// connection drops the reader reconnects with backoff and sends all the settings again; the time
+// spent disconnected is counted as a gap.
+//
+class RtlTcpSource : public InputSource
+{
+  public:
+    RtlTcpSource(const char *host, int port);
+
+    bool open() override;
+    bool setFrequency(uint32_t freq) override;
+    bool setSampleRate(uint32_t rate) override;
+    bool setGain(int agc, int gain) override;
+    bool setFreqCorrection(int ppm) override;
+    std::vector<int> tunerGains() override;
+
+    int run(Callback cb, void *ctx) override;
+    void stop() override;
+
+  private:
+    void readLoop();
+    int connectToServer();
+    bool sendCommand(int fd, uint8_t cmd, uint32_t param);
+    bool sendSettings(int fd);
+    void push(const unsigned char *data, size_t len);
+
+    const std::string m_host;
+    const int m_port;
+
+    // Held while sending commands, which can block for as long as the send timeout, so that they go
+    // out in the order they were set without holding up the stream
+    std::mutex m_sendMutex;
+
+    // Everything below is guarded by m_mutex.  The connection and the settings only change with
+    // m_sendMutex held as well, so either is enough to read them.
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_running = false;
+    int m_fd = -1;
+
+    uint32_t m_frequency = 0;
+    uint32_t m_sampleRate = 0;
+    int m_agc = 1;
+    int m_gain = 0;
+    int m_ppm = 0;
+    uint32_t m_tunerType = 0;
+
+    std::vector<unsigned char> m_ring;
+    size_t m_ringStart = 0;
+    size_t m_ringFill = 0;
+    bool m_overflowing = false;     // Dropping samples since the last push that fit
+};
+
+#endif
@@ -0,0 +1,3 @@
+#!/bin/sh
+g++  -o frameTapDump -fdiagnostics-color --std=c++11 frameTapDump.cpp ../frameTap.cpp -lrt
+g++  -o snapshotQuery -fdiagnostics-color --std=c++11 snapshotQuery.cpp -pthread
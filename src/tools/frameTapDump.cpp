@@ -0,0 +1,54 @@
+//
+// Prints every frame the decoder publishes to its shared memory tap (-m <name>), one line each, e.g.
+//
+//   ./frameTapDump 345tap
+//
+// Starts with the next frame written and keeps following the tap, also across decoder restarts.
+//
+
+#include "../frameTap.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <unistd.h>
+
+// How often to look for new frames, and to retry opening a tap that isn't there yet
+#define POLL_MS (50)
+#define OPEN_RETRY_SEC (1)
+
+int main(int argc, char **argv)
+{
+    if(argc != 2)
+    {
+        fprintf(stderr, "Usage: %s <shared memory name>\n", argv[0]);
+        return 1;
+    }
+
+    FrameTapReader reader;
+    while(!reader.open(argv[1]))
+    {
+        fprintf(stderr, "Waiting for the frame tap %s\n", argv[1]);
+        sleep(OPEN_RETRY_SEC);
+    }
+
+    uint64_t reportedMissed = 0;
+    FrameTapRecord record;
+    while(true)
+    {
+        while(reader.next(record))
+        {
+            printf("%" PRIu64 ".%06" PRIu64 " %012" PRIX64 " serial %u type %02X %s%s signal %.1f peak %.1f noise %.1f dBFS\n",
+                record.timestampUs/1000000, record.timestampUs%1000000, record.payload, record.serial, record.type,
+                record.crcOk ? "ok" : "crc-fail", record.repaired ? " (repaired)" : "",
+                record.signalDbfs, record.peakDbfs, record.noiseDbfs);
+        }
+
+        if(reader.missed() != reportedMissed)
+        {
+            fprintf(stderr, "Missed %" PRIu64 " frames\n", reader.missed() - reportedMissed);
+            reportedMissed = reader.missed();
+        }
+        fflush(stdout);
+        usleep(POLL_MS*1000);
+    }
+}
@@ -0,0 +1,127 @@
+//
+// Queries the device snapshot socket (-u <path>) and prints the document, e.g.
+//
+//   ./snapshotQuery /run/345.sock
+//
+// or, given a number of clients and seconds, keeps that many clients querying back to back and prints
+// how many queries were answered, for measuring what queries cost the decoder:
+//
+//   ./snapshotQuery /run/345.sock 4 10
+//
+// Stops early when the socket goes away, e.g. when a replay is over.
+//
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Time to wait for the decoder to create the socket before giving up
+#define CONNECT_RETRY_MS (5000)
+
+static bool query(const char *path, std::string &document)
+{
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0)
+    {
+        return false;
+    }
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if(connect(fd, (const sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    document.clear();
+    char buffer[64*1024];
+    ssize_t len;
+    while((len = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+    {
+        document.append(buffer, len);
+    }
+    close(fd);
+    return (len == 0);
+}
+
+int main(int argc, char **argv)
+{
+    if(argc != 2 && argc != 4)
+    {
+        fprintf(stderr, "Usage: %s <socket path> [<clients> <seconds>]\n", argv[0]);
+        return 1;
+    }
+    const char *path = argv[1];
+
+    // Give a decoder that is just starting time to open the socket
+    std::string document;
+    bool connected = false;
+    for(int waitedMs = 0; !connected && waitedMs < CONNECT_RETRY_MS; waitedMs += 10)
+    {
+        connected = query(path, document);
+        if(!connected)
+        {
+            usleep(10*1000);
+        }
+    }
+    if(!connected)
+    {
+        fprintf(stderr, "Nothing answering on %s\n", path);
+        return 1;
+    }
+
+    if(argc == 2)
+    {
+        printf("%s\n", document.c_str());
+        return 0;
+    }
+
+    const int clients = atoi(argv[2]);
+    const double seconds = atof(argv[3]);
+
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> queries(0);
+    std::atomic<uint64_t> bytes(0);
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for(int ii = 0; ii < clients; ++ii)
+    {
+        threads.emplace_back([&]()
+        {
+            std::string answer;
+            while(!stop && query(path, answer))
+            {
+                queries++;
+                bytes += answer.size();
+            }
+            stop = true;
+        });
+    }
+
+    while(!stop && std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() < seconds)
+    {
+        usleep(10*1000);
+    }
+    stop = true;
+    for(std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%llu queries in %.2fs, %.0f/s, %.0f bytes each\n", (unsigned long long)queries.load(), elapsed,
+        queries/elapsed, queries ? (double)bytes/queries : 0.0);
+    return 0;
+}